@@ -118,13 +118,14 @@ QMAKE_CXXFLAGS_WARN_ON = -fdiagnostics-show-option -Wall -Wextra -Wformat -Wform
 # Input
 DEPENDPATH += src src/json src/cryptopp src/qt
 
-HUNTERCOIN_HEADERS = headers.h strlcpy.h serialize.h uint256.h util.h key.h bignum.h base58.h scrypt.h \
+HUNTERCOIN_HEADERS = headers.h strlcpy.h serialize.h uint256.h hashmap.h checkqueue.h sha256.h util.h key.h bignum.h base58.h scrypt.h \
     script.h allocators.h db.h walletdb.h crypter.h net.h irc.h keystore.h main.h wallet.h bitcoinrpc.h uibase.h ui.h noui.h init.h auxpow.h \
     gamestate.h gamemap.h gamedb.h gametx.h gamemovecreator.h
 
 HUNTERCOIN_SOURCES = \
     auxpow.cpp \
     scrypt.cpp \
+    sha256.cpp \
     util.cpp \
     key.cpp \
     script.cpp \
@@ -284,7 +285,7 @@ gccsse2.input  = SOURCES_SSE2
 gccsse2.output = $$PWD/build/${QMAKE_FILE_BASE}.o
 gccsse2.commands = $(CXX) -c $(CXXFLAGS) $(INCPATH) -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_NAME} -msse2 -mstackrealign
 QMAKE_EXTRA_COMPILERS += gccsse2
-SOURCES_SSE2 += src/scrypt-sse2.cpp
+SOURCES_SSE2 += src/scrypt-sse2.cpp src/sha256-sse2.cpp
 }
 
 CODECFORTR = UTF-8
@@ -402,7 +402,7 @@ GetDifficulty (int algo)
 {
   const CBlockIndex* blockindex = GetLastBlockIndexForAlgo (pindexBest, algo);
   if (blockindex == NULL)
-    return GetDifficultyFromBits (bnInitialHashTarget[algo].GetCompact ());
+    return GetDifficultyFromBits (nInitialHashTarget[algo].GetCompact ());
 
   return GetDifficultyFromBits (blockindex->nBits);
 }
@@ -440,7 +440,7 @@ Value BlockToValue(const CBlock &block, const CBlockIndex* blockindex)
     obj.push_back(Pair("nonce", (uint64_t)block.nNonce));
     obj.push_back(Pair("bits", (uint64_t)block.nBits));
     obj.push_back(Pair("difficulty", GetDifficultyFromBits (block.nBits)));
-    obj.push_back(Pair("chainwork", blockindex->bnChainWork.GetHex()));
+    obj.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
 
     if (blockindex->pprev)
         obj.push_back(Pair("previousblockhash", block.hashPrevBlock.ToString().c_str()));
@@ -497,7 +497,7 @@ Value getblockbycount(const Array& params, bool fHelp)
     CBlockIndex* pindex;
     bool found = false;
 
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin();
+    for (BlockMap::iterator mi = mapBlockIndex.begin();
          mi != mapBlockIndex.end(); ++mi)
     {
         pindex = (*mi).second;
@@ -531,7 +531,7 @@ Value getblock(const Array& params, bool fHelp)
     uint256 hash;
     hash.SetHex(params[0].get_str());
 
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi == mapBlockIndex.end())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "hash not found");
 
@@ -549,7 +549,7 @@ Value getblock(const Array& params, bool fHelp)
 static bool
 compareBlocksByHeight (const uint256& a, const uint256& b)
 {
-  std::map<uint256, CBlockIndex*>::const_iterator ia, ib;
+  BlockMap::const_iterator ia, ib;
 
   ia = mapBlockIndex.find (a);
   ib = mapBlockIndex.find (b);
@@ -576,7 +576,7 @@ getchains (const Array& params, bool fHelp)
      the block as pprev) so that we find the chain heads.  */
 
   std::map<uint256, bool> blockIsHead;
-  std::map<uint256, CBlockIndex*>::const_iterator i;
+  BlockMap::const_iterator i;
 
   for (i = mapBlockIndex.begin (); i != mapBlockIndex.end (); ++i)
     blockIsHead.insert (std::make_pair (i->first, true));
@@ -764,6 +764,105 @@ Value getinfo(const Array& params, bool fHelp)
 }
 
 
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns statistics about the cache of verified signatures.");
+
+    unsigned int nEntries;
+    uint64 nHits, nMisses;
+    GetSigCacheStats(nEntries, nHits, nMisses);
+
+    Object obj;
+    obj.push_back(Pair("size",          (int)nEntries));
+    obj.push_back(Pair("maxsize",       nSigCacheSize));
+    obj.push_back(Pair("hits",          (boost::int64_t)nHits));
+    obj.push_back(Pair("misses",        (boost::int64_t)nMisses));
+    if (nHits + nMisses > 0)
+        obj.push_back(Pair("hitrate",   (double)nHits / (nHits + nMisses)));
+    return obj;
+}
+
+
+Value getnamecacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getnamecacheinfo\n"
+            "Returns statistics about the cache of name index entries.");
+
+    unsigned int nEntries;
+    uint64 nHits, nMisses;
+    GetNameCacheStats(nEntries, nHits, nMisses);
+
+    Object obj;
+    obj.push_back(Pair("size",          (int)nEntries));
+    obj.push_back(Pair("maxsize",       nNameCacheSize));
+    obj.push_back(Pair("hits",          (boost::int64_t)nHits));
+    obj.push_back(Pair("misses",        (boost::int64_t)nMisses));
+    if (nHits + nMisses > 0)
+        obj.push_back(Pair("hitrate",   (double)nHits / (nHits + nMisses)));
+    return obj;
+}
+
+
+Value gettxcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gettxcacheinfo\n"
+            "Returns statistics about the cache of transactions read from disk.");
+
+    unsigned int nEntries;
+    uint64 nHits, nMisses;
+    GetTxCacheStats(nEntries, nHits, nMisses);
+
+    Object obj;
+    obj.push_back(Pair("size",          (int)nEntries));
+    obj.push_back(Pair("maxsize",       nTxCacheSize));
+    obj.push_back(Pair("hits",          (boost::int64_t)nHits));
+    obj.push_back(Pair("misses",        (boost::int64_t)nMisses));
+    if (nHits + nMisses > 0)
+        obj.push_back(Pair("hitrate",   (double)nHits / (nHits + nMisses)));
+    return obj;
+}
+
+
+Value getdbmaintenanceinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbmaintenanceinfo\n"
+            "Returns statistics about the background database checkpoints, log files and cache.");
+
+    if (!fDBMaintenance)
+        throw JSONRPCError(RPC_MISC_ERROR, "Database maintenance thread is disabled (-dbmaintenance=0)");
+
+    CDBMaintenanceStats stats;
+    GetDBMaintenanceStats(stats);
+
+    Object obj;
+    obj.push_back(Pair("checkpoints",       stats.nCheckpoints));
+    obj.push_back(Pair("lastcheckpoint",    (boost::int64_t)stats.nLastCheckpointTime));
+    obj.push_back(Pair("lastcheckpointms",  (boost::int64_t)stats.nLastCheckpointMillis));
+    obj.push_back(Pair("maxcheckpointms",   (boost::int64_t)stats.nMaxCheckpointMillis));
+    obj.push_back(Pair("totalcheckpointms", (boost::int64_t)stats.nTotalCheckpointMillis));
+    obj.push_back(Pair("logfiles",          stats.nLogFiles));
+    obj.push_back(Pair("logbytes",          (boost::int64_t)stats.nLogBytes));
+    obj.push_back(Pair("logsincecheckpoint", (boost::int64_t)stats.nLogBytesSinceCheckpoint));
+    obj.push_back(Pair("cachepages",        (boost::int64_t)stats.nPages));
+    obj.push_back(Pair("cachedirty",        (boost::int64_t)stats.nPagesDirty));
+    obj.push_back(Pair("trickled",          (boost::int64_t)stats.nPagesTrickled));
+    obj.push_back(Pair("cachehits",         (boost::int64_t)stats.nCacheHits));
+    obj.push_back(Pair("cachemisses",       (boost::int64_t)stats.nCacheMisses));
+    if (stats.nCacheHits + stats.nCacheMisses > 0)
+        obj.push_back(Pair("cachehitrate",  (double)stats.nCacheHits / (stats.nCacheHits + stats.nCacheMisses)));
+    return obj;
+}
+
+
 Value getnewaddress(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -806,7 +905,7 @@ string GetAccountAddress(string strAccount, bool bForceNew=false)
     {
         CScript scriptPubKey;
         scriptPubKey.SetBitcoinAddress(account.vchPubKey);
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin();
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin();
              it != pwalletMain->mapWallet.end() && !account.vchPubKey.empty();
              ++it)
         {
@@ -1087,7 +1186,7 @@ Value getreceivedbyaddress(const Array& params, bool fHelp)
     int64 nAmount = 0;
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
     {
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             if (wtx.IsCoinBase() || !wtx.IsFinal())
@@ -1146,7 +1245,7 @@ Value getreceivedbyaccount(const Array& params, bool fHelp)
     int64 nAmount = 0;
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
     {
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             if (wtx.IsCoinBase() || !wtx.IsFinal())
@@ -1169,7 +1268,7 @@ int64 GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMinD
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
     {
         // Tally wallet transactions
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             if (!wtx.IsFinal())
@@ -1217,7 +1316,7 @@ Value getbalance(const Array& params, bool fHelp)
         // (GetBalance() sums up all unspent TxOuts)
         // getbalance and getbalance '*' 0 should return the same number
         int64 nBalance = 0;
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             if (!wtx.IsFinal())
@@ -1427,7 +1526,7 @@ Value ListReceived(const Array& params, bool fByAccounts)
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
     CRITICAL_BLOCK(pwalletMain->cs_mapKeys)
     {
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             if (wtx.IsCoinBase() || !wtx.IsFinal())
@@ -1702,7 +1801,7 @@ Value listsinceblock(const Array& params, bool fHelp)
 
     Array transactions;
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
     {
         CWalletTx tx = (*it).second;
 
@@ -1763,7 +1862,7 @@ Value listtransactions(const Array& params, bool fHelp)
         typedef multimap<int64, TxPair > TxItems;
         TxItems txByTime;
 
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             CWalletTx* wtx = &((*it).second);
             txByTime.insert(make_pair(wtx->GetTxTime(), TxPair(wtx, (CAccountingEntry*)0)));
@@ -1825,7 +1924,7 @@ Value listaccounts(const Array& params, bool fHelp)
                 mapAccountBalances[entry.second] = 0;
         }
 
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+        for (WalletTxMap::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
         {
             const CWalletTx& wtx = (*it).second;
             int64 nGeneratedImmature, nGeneratedMature, nFee;
@@ -2214,7 +2313,7 @@ Value getwork(const Array& params, bool fHelp)
         char phash1[64];
         FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
         Object result;
         result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate))));
@@ -2336,7 +2435,7 @@ Value getworkaux(const Array& params, bool fHelp)
         char phash1[64];
         FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
         Object result;
         result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate))));
@@ -2603,7 +2702,7 @@ Value getauxblock(const Array& params, bool fHelp)
             result.push_back(Pair("hash", pblockSCRYPT->GetHash().GetHex()));
             result.push_back(Pair("coinbasevalue", (int64_t)pblockSCRYPT->vtx[0].vout[0].nValue));
             result.push_back(Pair("chainid", pblockSCRYPT->GetChainID()));
-            uint256 hashTarget = CBigNum().SetCompact(pblockSCRYPT->nBits).getuint256();
+            uint256 hashTarget = uint256().SetCompact(pblockSCRYPT->nBits);
             result.push_back(Pair("_target", HexStr(BEGIN(hashTarget), END(hashTarget)))); // deprecated, use bits instead
             return result;
         }
@@ -2682,7 +2781,7 @@ Value getauxblock(const Array& params, bool fHelp)
             result.push_back(Pair("hash", pblockSHA256D->GetHash().GetHex()));
             result.push_back(Pair("coinbasevalue", (int64_t)pblockSHA256D->vtx[0].vout[0].nValue));
             result.push_back(Pair("chainid", pblockSHA256D->GetChainID()));
-            uint256 hashTarget = CBigNum().SetCompact(pblockSHA256D->nBits).getuint256();
+            uint256 hashTarget = uint256().SetCompact(pblockSHA256D->nBits);
             result.push_back(Pair("_target", HexStr(BEGIN(hashTarget), END(hashTarget)))); // deprecated, use bits instead
             return result;
         }
@@ -3089,7 +3188,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        map<uint256, CBlockIndex*>::const_iterator mi = mapBlockIndex.find(hashBlock);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second)
         {
             pindex = (*mi).second;
@@ -3433,6 +3532,7 @@ Value signrawtransaction(const Array& params, bool fHelp)
     // mergedTx will end up with all the signatures; it
     // starts as a clone of the rawtx:
     CTransaction mergedTx(txVariants[0]);
+    mergedTx.MakeMutable();
     bool fComplete = true;
 
     /* Fetch previous outputs from the wallet, memory or the UTXO set.  */
@@ -3440,7 +3540,8 @@ Value signrawtransaction(const Array& params, bool fHelp)
     CRITICAL_BLOCK(cs_mapTransactions)
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
       {
-        DatabaseSet dbset("r");
+        CReadDatabaseSet readDbset;
+        DatabaseSet& dbset = *readDbset;
         BOOST_FOREACH (const CTxIn& txin, mergedTx.vin)
           {
             const COutPoint& op = txin.prevout;
@@ -3620,7 +3721,8 @@ Value sendrawtransaction(const Array& params, bool fHelp)
     else
     {
         // push to local node
-        DatabaseSet dbset("r");
+        CReadDatabaseSet readDbset;
+        DatabaseSet& dbset = *readDbset;
         if (!tx.AcceptToMemoryPool (dbset, true))
             throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX rejected");
 
@@ -3672,6 +3774,10 @@ pair<string, rpcfn_type> pCallTable[] =
     make_pair("setgenerate",           &setgenerate),
     make_pair("gethashespersec",       &gethashespersec),
     make_pair("getinfo",               &getinfo),
+    make_pair("getsigcacheinfo",       &getsigcacheinfo),
+    make_pair("getnamecacheinfo",      &getnamecacheinfo),
+    make_pair("gettxcacheinfo",        &gettxcacheinfo),
+    make_pair("getdbmaintenanceinfo",  &getdbmaintenanceinfo),
     make_pair("getnewaddress",         &getnewaddress),
     make_pair("getaccountaddress",     &getaccountaddress),
     make_pair("setaccount",            &setaccount),
@@ -3741,6 +3847,10 @@ string pAllowInSafeMode[] =
     "setgenerate",
     "gethashespersec",
     "getinfo",
+    "getsigcacheinfo",
+    "getnamecacheinfo",
+    "gettxcacheinfo",
+    "getdbmaintenanceinfo",
     "getnewaddress",
     "getaccountaddress",
     "setlabel",
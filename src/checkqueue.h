@@ -0,0 +1,211 @@
+#ifndef HUNTERCOIN_CHECKQUEUE_H
+#define HUNTERCOIN_CHECKQUEUE_H
+
+#include <algorithm>
+#include <vector>
+
+#ifndef Q_MOC_RUN
+#include <boost/foreach.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#endif
+
+/* Queue of independent checks (e.g., script verifications) that can be
+   processed by a pool of worker threads.  The thread that submits the
+   checks (the "master") calls Wait to join in the processing, and Wait
+   returns once all checks are done, telling whether all of them
+   succeeded.  Only a single master may use the queue at a time.
+
+   T must be default-constructible, provide a swap method and be callable
+   as bool operator() ().  Checks are swapped into and out of the queue
+   so that (potentially large) scripts are not copied around.  */
+
+template<typename T>
+  class CCheckQueue
+{
+private:
+
+  /* Lock protecting all the fields below.  */
+  boost::mutex mutex;
+
+  /* Signalled for workers when new checks are available, and for the
+     master when the last outstanding check has been finished.  */
+  boost::condition_variable condWorker;
+  boost::condition_variable condMaster;
+
+  /* Checks waiting to be processed.  */
+  std::vector<T> queue;
+
+  /* Number of checks added but not yet finished (including those taken
+     out of the queue and currently being processed).  */
+  unsigned nTodo;
+
+  /* Whether all checks finished so far were successful.  */
+  bool fAllOk;
+
+  /* Maximum number of checks a thread takes out of the queue at once.  */
+  const unsigned nBatchSize;
+
+  /* Number of threads (workers and the master) processing the queue.  */
+  unsigned nThreads;
+
+  bool
+  Loop (bool fMaster)
+  {
+    std::vector<T> vChecks;
+    vChecks.reserve (nBatchSize);
+    unsigned nNow = 0;
+    bool fOk = true;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!fMaster)
+      ++nThreads;
+    while (true)
+      {
+        /* Account for the checks we have just finished.  */
+        if (nNow > 0)
+          {
+            fAllOk = fAllOk && fOk;
+            nTodo -= nNow;
+            nNow = 0;
+            if (nTodo == 0 && !fMaster)
+              condMaster.notify_one ();
+          }
+
+        while (queue.empty ())
+          {
+            if (fMaster && nTodo == 0)
+              {
+                const bool fRet = fAllOk;
+                fAllOk = true;
+                return fRet;
+              }
+            if (fMaster)
+              condMaster.wait (lock);
+            else
+              condWorker.wait (lock);
+          }
+
+        /* Take a share of the remaining checks, but leave enough for the
+           other threads so that the work is spread evenly.  */
+        nNow = std::max (1u, std::min (nBatchSize,
+                                       static_cast<unsigned> (queue.size ())
+                                         / (nThreads + 1)));
+        vChecks.resize (nNow);
+        for (unsigned i = 0; i < nNow; ++i)
+          {
+            vChecks[i].swap (queue.back ());
+            queue.pop_back ();
+          }
+
+        /* Once something failed, the remaining checks need not be run.  */
+        fOk = fAllOk;
+
+        lock.unlock ();
+        BOOST_FOREACH (T& check, vChecks)
+          if (fOk)
+            fOk = check ();
+        vChecks.clear ();
+        lock.lock ();
+      }
+  }
+
+public:
+
+  explicit CCheckQueue (unsigned nBatchSizeIn)
+    : nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn), nThreads(1)
+  {}
+
+  /* Run as worker thread.  This never returns.  */
+  inline void
+  Thread ()
+  {
+    Loop (false);
+  }
+
+  /* Add checks to the queue.  The elements of vChecks are swapped out
+     and the vector cleared.  */
+  void
+  Add (std::vector<T>& vChecks)
+  {
+    if (vChecks.empty ())
+      return;
+
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      BOOST_FOREACH (T& check, vChecks)
+        {
+          queue.push_back (T ());
+          check.swap (queue.back ());
+        }
+      nTodo += vChecks.size ();
+    }
+    vChecks.clear ();
+
+    condWorker.notify_all ();
+  }
+
+  /* Process checks until the queue is empty and wait for the workers to
+     finish theirs.  Returns whether all checks added since the last
+     call succeeded.  */
+  inline bool
+  Wait ()
+  {
+    return Loop (true);
+  }
+
+};
+
+/* Scoped helper for the master side of a CCheckQueue.  It makes sure that
+   Wait is called before leaving the scope, even on an early error return,
+   so that no checks referring to freed data remain in the queue.  If the
+   queue is NULL, Add runs the checks directly.  */
+
+template<typename T>
+  class CCheckQueueControl
+{
+private:
+
+  CCheckQueue<T>* pqueue;
+  bool fDone;
+  bool fOk;
+
+public:
+
+  explicit CCheckQueueControl (CCheckQueue<T>* q)
+    : pqueue(q), fDone(false), fOk(true)
+  {}
+
+  ~CCheckQueueControl ()
+  {
+    if (!fDone)
+      Wait ();
+  }
+
+  void
+  Add (std::vector<T>& vChecks)
+  {
+    if (pqueue)
+      pqueue->Add (vChecks);
+    else
+      {
+        BOOST_FOREACH (T& check, vChecks)
+          if (fOk)
+            fOk = check ();
+        vChecks.clear ();
+      }
+  }
+
+  bool
+  Wait ()
+  {
+    fDone = true;
+    if (pqueue && !pqueue->Wait ())
+      fOk = false;
+    return fOk;
+  }
+
+};
+
+#endif // HUNTERCOIN_CHECKQUEUE_H
@@ -10,6 +10,7 @@
 #include "init.h"
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/thread/tss.hpp>
 
 using namespace std;
 using namespace boost;
@@ -26,6 +27,11 @@ unsigned int nWalletDBUpdated;
 static CCriticalSection cs_db;
 static bool fDbEnvInit = false;
 bool fDetachDB = false;
+bool fDBMaintenance = true;
+// Held by the maintenance thread while it works on the environment, so that
+// it is not closed underneath
+static CCriticalSection cs_dbmaint;
+static bool fDBMaintenanceRunning = false;
 DbEnv dbenv(0);
 static map<string, int> mapFileUseCount;
 static map<string, Db*> mapDb;
@@ -47,9 +53,18 @@ public:
 }
 instance_of_cdbinit;
 
+static boost::thread_specific_ptr<CDBBuffers> pdbbuffers;
 
-CDB::CDB(const char* pszFile, const char* pszMode)
-  : pdb(NULL), nVersion(VERSION)
+CDBBuffers& GetDBBuffers()
+{
+    if (!pdbbuffers.get())
+        pdbbuffers.reset(new CDBBuffers());
+    return *pdbbuffers;
+}
+
+
+CDB::CDB(const char* pszFile, const char* pszMode, bool fSecureIn)
+  : pdb(NULL), nVersion(VERSION), fSecure(fSecureIn)
 {
     int ret;
     if (pszFile == NULL)
@@ -162,8 +177,11 @@ CDB::Close ()
                && IsInitialBlockDownload ())
         nMinutes = 5;
 
-      dbenv.txn_checkpoint (nMinutes ? GetArg ("-dblogsize", 100) * 1024 : 0,
-                            nMinutes, 0);
+      /* Periodic checkpoints are done in the background by
+         ThreadDBMaintenance if it is running.  */
+      if (nMinutes == 0 || !fDBMaintenanceRunning)
+        dbenv.txn_checkpoint (nMinutes ? GetArg ("-dblogsize", 100) * 1024 : 0,
+                              nMinutes, 0);
     }
 
   CRITICAL_BLOCK(cs_db)
@@ -230,8 +248,8 @@ bool CDB::Rewrite(const string& strFile)
                     if (pcursor)
                         while (fSuccess)
                         {
-                            CDataStream ssKey(SER_DISK, VERSION);
-                            CDataStream ssValue(SER_DISK, VERSION);
+                            CSecureDataStream ssKey(SER_DISK, VERSION);
+                            CSecureDataStream ssValue(SER_DISK, VERSION);
                             int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
                             if (ret == DB_NOTFOUND)
                             {
@@ -370,6 +388,52 @@ CDB::PrintStorageStats (const std::string& file)
     }
 }
 
+/* Handles not currently borrowed by a CReadDatabaseSet.  */
+static CCriticalSection cs_readdbsets;
+static std::vector<DatabaseSet*> vReadDatabaseSets;
+static const unsigned MAX_POOLED_READ_DBSETS = 16;
+
+CReadDatabaseSet::CReadDatabaseSet ()
+  : pset(NULL)
+{
+  CRITICAL_BLOCK (cs_readdbsets)
+    if (!vReadDatabaseSets.empty ())
+      {
+        pset = vReadDatabaseSets.back ();
+        vReadDatabaseSets.pop_back ();
+      }
+
+  /* Open a new set outside of the pool lock, since that takes cs_db.  */
+  if (!pset)
+    pset = new DatabaseSet ("r");
+}
+
+CReadDatabaseSet::~CReadDatabaseSet ()
+{
+  if (!fShutdown)
+    CRITICAL_BLOCK (cs_readdbsets)
+      if (vReadDatabaseSets.size () < MAX_POOLED_READ_DBSETS)
+        {
+          vReadDatabaseSets.push_back (pset);
+          pset = NULL;
+        }
+
+  delete pset;
+}
+
+void
+CloseReadDatabaseSets ()
+{
+  /* Take the handles out of the pool first and close them without holding
+     its lock, so that cs_db is never acquired while holding it.  */
+  std::vector<DatabaseSet*> vClose;
+  CRITICAL_BLOCK (cs_readdbsets)
+    vClose.swap (vReadDatabaseSets);
+
+  BOOST_FOREACH (DatabaseSet* pset, vClose)
+    delete pset;
+}
+
 void DBFlush(bool fShutdown)
 {
     // Flush log data to the actual data file
@@ -377,6 +441,7 @@ void DBFlush(bool fShutdown)
     printf("DBFlush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " db not started");
     if (!fDbEnvInit)
         return;
+    CloseReadDatabaseSets();
     CRITICAL_BLOCK(cs_db)
     {
         map<string, int>::iterator mi = mapFileUseCount.begin();
@@ -407,15 +472,18 @@ void DBFlush(bool fShutdown)
             char** listp;
             if (mapFileUseCount.empty())
                 dbenv.log_archive(&listp, DB_ARCH_REMOVE);
-            try
-            {
-                dbenv.close(0);
-            }
-            catch (const DbException& e)
+            CRITICAL_BLOCK(cs_dbmaint)
             {
-                printf("EnvShutdown exception: %s (%d)\n", e.what(), e.get_errno());
+                try
+                {
+                    dbenv.close(0);
+                }
+                catch (const DbException& e)
+                {
+                    printf("EnvShutdown exception: %s (%d)\n", e.what(), e.get_errno());
+                }
+                fDbEnvInit = false;
             }
-            fDbEnvInit = false;
         }
     }
 }
@@ -429,17 +497,186 @@ void DBFlush(bool fShutdown)
 // CTxDB
 //
 
+int nTxCacheSize = 10000;
+
+// LRU cache of tx index entries and (if already read) the transactions
+// themselves.  The index entries never change during normal operation, so
+// the same transactions looked up repeatedly (inputs of game moves, wallet
+// transactions, RPC calls) are served from memory.  Entries are dropped
+// when the index is changed.
+class CTxCache
+{
+private:
+    struct CEntry
+    {
+        CTxIndex txindex;
+        bool fHaveTx;
+        CTransaction tx;
+        list<uint256>::iterator itLRU;
+    };
+    typedef map<uint256, CEntry> EntryMap;
+
+    // Most recently used transactions first
+    list<uint256> lru;
+    EntryMap entries;
+
+    // Incremented whenever an entry is invalidated.  Readers only add what
+    // they have read from disk if nothing was invalidated meanwhile.
+    uint64 nGeneration;
+
+    uint64 nHits;
+    uint64 nMisses;
+    CCriticalSection cs_txcache;
+
+    EntryMap::iterator Insert(const uint256& hash, const CTxIndex& txindex)
+    {
+        while (!entries.empty() && entries.size() >= (unsigned int)nTxCacheSize)
+        {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(hash);
+        CEntry& entry = entries[hash];
+        entry.txindex = txindex;
+        entry.fHaveTx = false;
+        entry.itLRU = lru.begin();
+        return entries.find(hash);
+    }
+
+public:
+    CTxCache() : nGeneration(0), nHits(0), nMisses(0) { }
+
+    // Look up the index entry and, if ptx is given, also the transaction
+    bool Get(const uint256& hash, CTxIndex& txindex, CTransaction* ptx, uint64& nGen)
+    {
+        CRITICAL_BLOCK(cs_txcache)
+        {
+            nGen = nGeneration;
+            EntryMap::iterator mi = entries.find(hash);
+            if (mi == entries.end() || (ptx && !mi->second.fHaveTx))
+            {
+                ++nMisses;
+                return false;
+            }
+
+            ++nHits;
+            lru.splice(lru.begin(), lru, mi->second.itLRU);
+            txindex = mi->second.txindex;
+            if (ptx)
+                *ptx = mi->second.tx;
+        }
+        return true;
+    }
+
+    void Set(const uint256& hash, const CTxIndex& txindex, const CTransaction* ptx, uint64 nGen)
+    {
+        if (nTxCacheSize <= 0)
+            return;
+
+        CRITICAL_BLOCK(cs_txcache)
+        {
+            if (nGen != nGeneration)
+                return;
+
+            EntryMap::iterator mi = entries.find(hash);
+            if (mi == entries.end())
+                mi = Insert(hash, txindex);
+            if (ptx && !mi->second.fHaveTx)
+            {
+                mi->second.tx = *ptx;
+                mi->second.fHaveTx = true;
+            }
+        }
+    }
+
+    void Erase(const uint256& hash)
+    {
+        CRITICAL_BLOCK(cs_txcache)
+        {
+            ++nGeneration;
+            EntryMap::iterator mi = entries.find(hash);
+            if (mi != entries.end())
+            {
+                lru.erase(mi->second.itLRU);
+                entries.erase(mi);
+            }
+        }
+    }
+
+    void GetStats(unsigned int& nEntries, uint64& nHitsRet, uint64& nMissesRet)
+    {
+        CRITICAL_BLOCK(cs_txcache)
+        {
+            nEntries = entries.size();
+            nHitsRet = nHits;
+            nMissesRet = nMisses;
+        }
+    }
+};
+
+static CTxCache txcache;
+
+void GetTxCacheStats(unsigned int& nEntries, uint64& nHits, uint64& nMisses)
+{
+    txcache.GetStats(nEntries, nHits, nMisses);
+}
+
+void CTxDB::Invalidate(const uint256& hash)
+{
+    if (!vTxn.empty())
+        setTxnChanged.insert(hash);
+    txcache.Erase(hash);
+}
+
+bool CTxDB::TxnCommit()
+{
+    const bool fOk = CDB::TxnCommit();
+    if (vTxn.empty())
+    {
+        BOOST_FOREACH(const uint256& hash, setTxnChanged)
+            txcache.Erase(hash);
+        setTxnChanged.clear();
+    }
+    return fOk;
+}
+
+bool CTxDB::TxnAbort()
+{
+    const bool fOk = CDB::TxnAbort();
+    if (vTxn.empty())
+    {
+        BOOST_FOREACH(const uint256& hash, setTxnChanged)
+            txcache.Erase(hash);
+        setTxnChanged.clear();
+    }
+    return fOk;
+}
+
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
 {
     assert(!fClient);
+
+    // Entries changed in our own open transaction are not yet committed,
+    // so the cache may be stale for them and must not get the new value
     txindex.SetNull();
-    return Read(make_pair(string("tx"), hash), txindex);
+    if (setTxnChanged.count(hash) > 0)
+        return Read(make_pair(string("tx"), hash), txindex);
+
+    uint64 nGen;
+    if (txcache.Get(hash, txindex, NULL, nGen))
+        return true;
+
+    if (!Read(make_pair(string("tx"), hash), txindex))
+        return false;
+    txcache.Set(hash, txindex, NULL, nGen);
+    return true;
 }
 
 bool
 CTxDB::UpdateTxIndex (const uint256& hash, const CTxIndex& txindex)
 {
   assert (!fClient);
+  Invalidate (hash);
   return Write (std::make_pair (std::string ("tx"), hash), txindex);
 }
 
@@ -450,6 +687,7 @@ bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos)
     // Add to tx index
     uint256 hash = tx.GetHash();
     CTxIndex txindex(pos);
+    Invalidate(hash);
     return Write(make_pair(string("tx"), hash), txindex);
 }
 
@@ -458,22 +696,39 @@ bool CTxDB::EraseTxIndex(const CTransaction& tx)
     assert(!fClient);
     uint256 hash = tx.GetHash();
 
+    Invalidate(hash);
     return Erase(make_pair(string("tx"), hash));
 }
 
 bool CTxDB::ContainsTx(uint256 hash)
 {
     assert(!fClient);
+    CTxIndex txindex;
+    uint64 nGen;
+    if (setTxnChanged.count(hash) == 0 && txcache.Get(hash, txindex, NULL, nGen))
+        return true;
     return Exists(make_pair(string("tx"), hash));
 }
 
 bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
 {
     assert(!fClient);
+    const bool fChanged = (setTxnChanged.count(hash) > 0);
+    uint64 nGen;
+    if (!fChanged && txcache.Get(hash, txindex, &tx, nGen))
+        return true;
+
+    // Not through ReadTxIndex, which would count a second cache lookup
     tx.SetNull();
-    if (!ReadTxIndex(hash, txindex))
+    txindex.SetNull();
+    if (!Read(make_pair(string("tx"), hash), txindex))
+        return false;
+    if (!tx.ReadFromDisk(txindex.pos))
         return false;
-    return (tx.ReadFromDisk(txindex.pos));
+
+    if (!fChanged)
+        txcache.Set(hash, txindex, &tx, nGen);
+    return true;
 }
 
 bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx)
@@ -513,14 +768,30 @@ bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
     return Write(string("hashBestChain"), hashBestChain);
 }
 
-bool CTxDB::ReadBestInvalidWork(CBigNum& bnBestInvalidWork)
+// The best invalid work is stored as CBigNum on disk, so that the
+// database format stays compatible with older versions.
+bool CTxDB::ReadBlockIndexSnapshotId(uint256& hashId)
 {
-    return Read(string("bnBestInvalidWork"), bnBestInvalidWork);
+    return Read(string("snapshotid"), hashId);
 }
 
-bool CTxDB::WriteBestInvalidWork(CBigNum bnBestInvalidWork)
+bool CTxDB::WriteBlockIndexSnapshotId(const uint256& hashId)
 {
-    return Write(string("bnBestInvalidWork"), bnBestInvalidWork);
+    return Write(string("snapshotid"), hashId);
+}
+
+bool CTxDB::ReadBestInvalidWork(uint256& nBestInvalidWork)
+{
+    CBigNum bnBestInvalidWork;
+    if (!Read(string("bnBestInvalidWork"), bnBestInvalidWork))
+        return false;
+    nBestInvalidWork = bnBestInvalidWork.getuint256();
+    return true;
+}
+
+bool CTxDB::WriteBestInvalidWork(const uint256& nBestInvalidWork)
+{
+    return Write(string("bnBestInvalidWork"), CBigNum(nBestInvalidWork));
 }
 
 unsigned
@@ -552,14 +823,12 @@ CBlockIndex static * InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = AllocateBlockIndex();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -568,7 +837,301 @@ CBlockIndex static * InsertBlockIndex(uint256 hash)
 
 #include <fstream>
 
-bool CTxDB::LoadBlockIndex()
+CBlockIndex static * InsertDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex)
+{
+    // Construct block index object
+    CBlockIndex* pindexNew = InsertBlockIndex(hash);
+    pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+    pindexNew->nFile          = diskindex.nFile;
+    pindexNew->nBlockPos      = diskindex.nBlockPos;
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->hashGameMerkleRoot = diskindex.hashGameMerkleRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+
+    // Watch for genesis block
+    if (pindexGenesisBlock == NULL && hash == hashGenesisBlock)
+        pindexGenesisBlock = pindexNew;
+
+    return pindexNew;
+}
+
+//
+// Flat block index snapshot
+//
+// On clean shutdown, the whole block index is written to a flat file of
+// fixed-size records.  The next start reads it in one go instead of
+// scanning all "blockindex" records in blkindex.dat.  The snapshot is
+// deleted as soon as it has been read, so that it is never used after
+// an unclean shutdown.  A random id is stored both in the snapshot and in
+// blkindex.dat, so that it is only used together with the database it was
+// written for.  If anything about it doesn't match (version, checksum, id
+// or best chain), we fall back to the database scan.
+//
+
+static const unsigned int BLOCKINDEX_SNAPSHOT_MAGIC = 0x78646968; // "hidx"
+static const int BLOCKINDEX_SNAPSHOT_VERSION = 2;
+
+struct CBlockIndexSnapshotHeader
+{
+    unsigned int nMagic;
+    int nSnapshotVersion;
+    unsigned int nRecordSize;
+    unsigned int nCount;
+    uint256 hashBestChain;
+    uint256 hashSnapshotId;
+};
+
+struct CBlockIndexSnapshotRecord
+{
+    uint256 hashBlock;
+    uint256 hashPrev;
+    uint256 hashNext;
+    unsigned int nFile;
+    unsigned int nBlockPos;
+    int nHeight;
+    int nVersion;
+    uint256 hashMerkleRoot;
+    uint256 hashGameMerkleRoot;
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned int nNonce;
+};
+
+static string GetBlockIndexSnapshotFile()
+{
+    return GetDataDir() + "/blkindex.snapshot";
+}
+
+// Only used by BenchmarkDBReads, to compare both ways of reading
+class CBenchTxDB : public CTxDB
+{
+public:
+    CBenchTxDB() : CTxDB("r") { }
+
+    void SetSecure(bool fSecureIn)
+    {
+        fSecure = fSecureIn;
+    }
+
+    bool ReadDiskBlockIndex(const uint256& hash, CDiskBlockIndex& blockindex)
+    {
+        return Read(make_pair(string("blockindex"), hash), blockindex);
+    }
+};
+
+// Measures reads per second from blkindex.dat with fresh, locked streams
+// per read (as used for the wallet) and with the pooled buffers.
+void BenchmarkDBReads()
+{
+    const int nRounds = 5;
+
+    vector<uint256> vHashes;
+    vHashes.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHashes.push_back(item.first);
+    random_shuffle(vHashes.begin(), vHashes.end(), GetRandInt);
+    if (vHashes.size() > 100000)
+        vHashes.resize(100000);
+    if (vHashes.empty())
+        return;
+
+    CBenchTxDB txdb;
+    const double dReads = (double)nRounds * vHashes.size();
+    printf("BenchmarkDBReads: %.0f block index reads\n", dReads);
+    for (int nPass = 0; nPass < 3; ++nPass)
+    {
+        // The first pass only warms up the BDB cache
+        const bool fSecure = (nPass == 1);
+        txdb.SetSecure(fSecure);
+
+        unsigned int nFound = 0;
+        const int64 nStart = GetTimeMillis();
+        for (int i = 0; i < (nPass == 0 ? 1 : nRounds); ++i)
+            BOOST_FOREACH(const uint256& hash, vHashes)
+            {
+                CDiskBlockIndex blockindex;
+                if (txdb.ReadDiskBlockIndex(hash, blockindex))
+                    ++nFound;
+            }
+        const int64 nTime = std::max(GetTimeMillis() - nStart, (int64)1);
+        if (nPass == 0)
+            continue;
+
+        printf("  %s %6"PRI64d"ms  (%.0f reads/s, %u found)\n",
+               fSecure ? "locked streams:" : "pooled buffers:",
+               nTime, dReads * 1000.0 / nTime, nFound);
+    }
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    const int64 nStart = GetTimeMillis();
+    const string strFile = GetBlockIndexSnapshotFile();
+    const string strTmpFile = strFile + ".new";
+
+    CRITICAL_BLOCK(cs_main)
+    {
+        if (!pindexBest)
+            return false;
+
+        uint256 hashSnapshotId;
+        RAND_bytes((unsigned char*)&hashSnapshotId, sizeof(hashSnapshotId));
+        {
+            CTxDB txdb("r+");
+            if (!txdb.WriteBlockIndexSnapshotId(hashSnapshotId))
+                return error("WriteBlockIndexSnapshot() : writing the snapshot id failed");
+        }
+
+        FILE* file = fopen(strTmpFile.c_str(), "wb");
+        if (!file)
+            return error("WriteBlockIndexSnapshot() : fopen %s failed", strTmpFile.c_str());
+
+        SHA256_CTX ctx;
+        SHA256_Init(&ctx);
+
+        CBlockIndexSnapshotHeader header;
+        header.nMagic = BLOCKINDEX_SNAPSHOT_MAGIC;
+        header.nSnapshotVersion = BLOCKINDEX_SNAPSHOT_VERSION;
+        header.nRecordSize = sizeof(CBlockIndexSnapshotRecord);
+        header.nCount = mapBlockIndex.size();
+        header.hashBestChain = hashBestChain;
+        header.hashSnapshotId = hashSnapshotId;
+        SHA256_Update(&ctx, &header, sizeof(header));
+        bool fOk = (fwrite(&header, sizeof(header), 1, file) == 1);
+
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            const CBlockIndex* pindex = item.second;
+            CBlockIndexSnapshotRecord rec;
+            rec.hashBlock = item.first;
+            rec.hashPrev = (pindex->pprev ? pindex->pprev->GetBlockHash() : 0);
+            rec.hashNext = (pindex->pnext ? pindex->pnext->GetBlockHash() : 0);
+            rec.nFile = pindex->nFile;
+            rec.nBlockPos = pindex->nBlockPos;
+            rec.nHeight = pindex->nHeight;
+            rec.nVersion = pindex->nVersion;
+            rec.hashMerkleRoot = pindex->hashMerkleRoot;
+            rec.hashGameMerkleRoot = pindex->hashGameMerkleRoot;
+            rec.nTime = pindex->nTime;
+            rec.nBits = pindex->nBits;
+            rec.nNonce = pindex->nNonce;
+            SHA256_Update(&ctx, &rec, sizeof(rec));
+            if (fOk)
+                fOk = (fwrite(&rec, sizeof(rec), 1, file) == 1);
+        }
+
+        // The checksum is the double-SHA256 of everything before it,
+        // the same as Hash() computes.
+        uint256 hash1;
+        SHA256_Final((unsigned char*)&hash1, &ctx);
+        uint256 hashChecksum;
+        SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hashChecksum);
+        if (fOk)
+            fOk = (fwrite(&hashChecksum, sizeof(hashChecksum), 1, file) == 1);
+
+        fflush(file);
+#ifdef __WXMSW__
+        _commit(_fileno(file));
+#else
+        fsync(fileno(file));
+#endif
+        fclose(file);
+        if (!fOk)
+        {
+            filesystem::remove(strTmpFile);
+            return error("WriteBlockIndexSnapshot() : writing %s failed", strTmpFile.c_str());
+        }
+
+        filesystem::rename(strTmpFile, strFile);
+        printf("WriteBlockIndexSnapshot() : wrote %u entries in %"PRI64d"ms\n",
+               header.nCount, GetTimeMillis() - nStart);
+    }
+
+    return true;
+}
+
+bool CTxDB::LoadBlockIndexSnapshot()
+{
+    const int64 nStart = GetTimeMillis();
+    const string strFile = GetBlockIndexSnapshotFile();
+
+    // Read the whole file into memory and remove it right away.  If it can
+    // not be removed, it might be read again later, so don't use it at all.
+    vector<char> vData;
+    {
+        FILE* file = fopen(strFile.c_str(), "rb");
+        if (!file)
+            return false;
+        fseek(file, 0, SEEK_END);
+        const long nSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (nSize > 0)
+        {
+            vData.resize(nSize);
+            if (fread(&vData[0], nSize, 1, file) != 1)
+                vData.clear();
+        }
+        fclose(file);
+        if (!filesystem::remove(strFile))
+            return error("LoadBlockIndexSnapshot() : removing %s failed", strFile.c_str());
+    }
+
+    // Check header and checksum
+    CBlockIndexSnapshotHeader header;
+    if (vData.size() < sizeof(header) + sizeof(uint256))
+        return error("LoadBlockIndexSnapshot() : snapshot file too short");
+    memcpy(&header, &vData[0], sizeof(header));
+    if (header.nMagic != BLOCKINDEX_SNAPSHOT_MAGIC
+        || header.nSnapshotVersion != BLOCKINDEX_SNAPSHOT_VERSION
+        || header.nRecordSize != sizeof(CBlockIndexSnapshotRecord))
+        return error("LoadBlockIndexSnapshot() : unsupported snapshot format");
+    const size_t nDataSize = sizeof(header) + (size_t)header.nCount * sizeof(CBlockIndexSnapshotRecord);
+    if (vData.size() != nDataSize + sizeof(uint256))
+        return error("LoadBlockIndexSnapshot() : snapshot has wrong size");
+    uint256 hashChecksum;
+    memcpy(&hashChecksum, &vData[nDataSize], sizeof(hashChecksum));
+    if (Hash(vData.begin(), vData.begin() + nDataSize) != hashChecksum)
+        return error("LoadBlockIndexSnapshot() : checksum mismatch");
+
+    // Make sure the database wasn't changed since the snapshot was written
+    uint256 hashBestChainDB, hashSnapshotIdDB;
+    if (!ReadHashBestChain(hashBestChainDB) || hashBestChainDB != header.hashBestChain
+        || !ReadBlockIndexSnapshotId(hashSnapshotIdDB) || hashSnapshotIdDB != header.hashSnapshotId)
+        return error("LoadBlockIndexSnapshot() : snapshot doesn't match blkindex.dat");
+
+    ReserveBlockIndexArena(header.nCount);
+    const char* pdata = &vData[sizeof(header)];
+    for (unsigned int i = 0; i < header.nCount; ++i, pdata += sizeof(CBlockIndexSnapshotRecord))
+    {
+        CBlockIndexSnapshotRecord rec;
+        memcpy(&rec, pdata, sizeof(rec));
+
+        CDiskBlockIndex diskindex;
+        diskindex.hashPrev           = rec.hashPrev;
+        diskindex.hashNext           = rec.hashNext;
+        diskindex.nFile              = rec.nFile;
+        diskindex.nBlockPos          = rec.nBlockPos;
+        diskindex.nHeight            = rec.nHeight;
+        diskindex.nVersion           = rec.nVersion;
+        diskindex.hashMerkleRoot     = rec.hashMerkleRoot;
+        diskindex.hashGameMerkleRoot = rec.hashGameMerkleRoot;
+        diskindex.nTime              = rec.nTime;
+        diskindex.nBits              = rec.nBits;
+        diskindex.nNonce             = rec.nNonce;
+        InsertDiskBlockIndex(rec.hashBlock, diskindex);
+    }
+
+    printf("LoadBlockIndexSnapshot() : loaded %u entries in %"PRI64d"ms\n",
+           header.nCount, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CTxDB::LoadBlockIndexFromDB()
 {
     // Get database cursor
     Dbc* pcursor = GetCursor();
@@ -600,23 +1163,7 @@ bool CTxDB::LoadBlockIndex()
             SetStreamVersion (ssValue);
             ssValue >> diskindex;
 
-            // Construct block index object
-            CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-            pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
-            pindexNew->nFile          = diskindex.nFile;
-            pindexNew->nBlockPos      = diskindex.nBlockPos;
-            pindexNew->nHeight        = diskindex.nHeight;
-            pindexNew->nVersion       = diskindex.nVersion;
-            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-            pindexNew->hashGameMerkleRoot = diskindex.hashGameMerkleRoot;
-            pindexNew->nTime          = diskindex.nTime;
-            pindexNew->nBits          = diskindex.nBits;
-            pindexNew->nNonce         = diskindex.nNonce;
-
-            // Watch for genesis block
-            if (pindexGenesisBlock == NULL && diskindex.GetBlockHash() == hashGenesisBlock)
-                pindexGenesisBlock = pindexNew;
+            InsertDiskBlockIndex(diskindex.GetBlockHash(), diskindex);
         }
         else
         {
@@ -625,7 +1172,23 @@ bool CTxDB::LoadBlockIndex()
     }
     pcursor->close();
 
-    // Calculate bnChainWork
+    return true;
+}
+
+bool CTxDB::LoadBlockIndex()
+{
+    if (!LoadBlockIndexSnapshot())
+    {
+        // Nothing is inserted before the snapshot has been checked, but
+        // start the scan from an empty in-memory index in any case
+        mapBlockIndex.clear();
+        pindexGenesisBlock = NULL;
+        if (!LoadBlockIndexFromDB())
+            return false;
+    }
+
+    // Calculate nChainWork and build the skip pointers
+    const int64 nStartChainWork = GetTimeMillis();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -637,8 +1200,11 @@ bool CTxDB::LoadBlockIndex()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->bnChainWork = (pindex->pprev ? pindex->pprev->bnChainWork : 0) + pindex->GetBlockWork();
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWork();
+        pindex->BuildSkip();
     }
+    printf("LoadBlockIndex(): computed chain work for %d blocks in %"PRI64d"ms\n",
+           (int)vSortedByHeight.size(), GetTimeMillis() - nStartChainWork);
 
     // Load hashBestChain pointer to end of best chain
     if (!ReadHashBestChain(hashBestChain))
@@ -651,11 +1217,18 @@ bool CTxDB::LoadBlockIndex()
         return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
-    bnBestChainWork = pindexBest->bnChainWork;
+    nBestChainWork = pindexBest->nChainWork;
     printf("LoadBlockIndex(): hashBestChain=%s  height=%d\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight);
 
-    // Load bnBestInvalidWork, OK if it doesn't exist
-    ReadBestInvalidWork(bnBestInvalidWork);
+    // Replay blocks whose UTXO changes were still in the cache
+    {
+        CUtxoDB utxodb("r+");
+        if (!utxodb.CatchUp())
+            return error("CTxDB::LoadBlockIndex() : UTXO set catch-up failed");
+    }
+
+    // Load nBestInvalidWork, OK if it doesn't exist
+    ReadBestInvalidWork(nBestInvalidWork);
 
     // Verify blocks in the best chain
     CBlockIndex* pindexFork = NULL;
@@ -761,105 +1334,486 @@ CTxDB::RewriteTxIndex (int oldVersion)
 /* ************************************************************************** */
 /* CNameDB.  */
 
-bool
-CNameDB::ReadName (const vchType& name, CNameIndex& nidx)
-{
-  std::vector<CNameIndex> vec;
-  if (!ReadNameVec (name, vec) || vec.empty ())
-    return false;
+/* Cache of the latest CNameIndex of recently used names.  Move validation
+   and the game step look up the same (comparatively few) active players
+   over and over, which would otherwise each be a DB read.  */
 
-  nidx = vec.back ();
-  return true;
-}
+int nNameCacheSize = 20000;
 
-bool
-CNameDB::PushEntry (const vchType& name, const CNameIndex& value)
+class CNameCache
 {
-  std::vector<CNameIndex> vec;
-  if (ExistsName (name)
-      && !ReadNameVec (name, vec))
-    return error ("CNameDB::PushEntry: ReadNameVec failed");
+private:
 
-  vec.push_back (value);
-  return WriteName (name, vec);
-}
+  typedef std::list<vchType> LruList;
+  typedef std::map<vchType, std::pair<CNameIndex, LruList::iterator> > EntryMap;
 
-bool
-CNameDB::PopEntry (const vchType& name, int nHeight)
-{
-  /* Ensure that we don't pop across already pruned entries.  We need that
-     the remaining height (nHeight - 1) is not yet pruned (i. e., at least
-     than prunedHeight).  */
-  const int prunedHeight = ReadPrunedHeight ();
-  if (nHeight - 1 < prunedHeight)
-    return error ("CNameDB::PopEntry: height %d already pruned (up to %d)",
-                  nHeight, prunedHeight);
+  /* Names in order of use, most recent first.  */
+  LruList lru;
+  EntryMap entries;
 
-  std::vector<CNameIndex> vec;
-  if (!ReadNameVec (name, vec))
-    printf ("CNameDB::PopEntry: warning, name not in DB\n");
+  /* Incremented whenever an entry is invalidated.  Readers only add what
+     they have read from the DB if nothing was invalidated meanwhile.  */
+  uint64 nGeneration;
 
-  /* If the name doesn't exist or is already empty, there's nothing to pop.  */
-  if (vec.empty ())
+  uint64 nHits;
+  uint64 nMisses;
+  CCriticalSection cs_namecache;
+
+public:
+
+  CNameCache ()
+    : nGeneration(0), nHits(0), nMisses(0)
+  {}
+
+  bool
+  Get (const vchType& name, CNameIndex& nidx, uint64& nGen)
+  {
+    CRITICAL_BLOCK (cs_namecache)
+      {
+        nGen = nGeneration;
+        const EntryMap::iterator mi = entries.find (name);
+        if (mi == entries.end ())
+          {
+            ++nMisses;
+            return false;
+          }
+
+        ++nHits;
+        lru.splice (lru.begin (), lru, mi->second.second);
+        nidx = mi->second.first;
+      }
     return true;
+  }
 
-  if (vec.back ().nHeight != nHeight)
-    printf ("CNameDB::PopEntry: warning, height mismatch (%d, expected %d)\n",
-            vec.back ().nHeight, nHeight);
+  void
+  Set (const vchType& name, const CNameIndex& nidx, uint64 nGen)
+  {
+    if (nNameCacheSize <= 0)
+      return;
 
-  while (!vec.empty () && vec.back ().nHeight >= nHeight)
-    vec.pop_back ();
+    CRITICAL_BLOCK (cs_namecache)
+      {
+        if (nGen != nGeneration || entries.count (name) > 0)
+          return;
 
-  return WriteName (name, vec);
-}
+        while (entries.size () >= static_cast<unsigned> (nNameCacheSize))
+          {
+            entries.erase (lru.back ());
+            lru.pop_back ();
+          }
+
+        lru.push_front (name);
+        entries.insert (std::make_pair (name, std::make_pair (nidx,
+                                                              lru.begin ())));
+      }
+  }
+
+  void
+  Erase (const vchType& name)
+  {
+    CRITICAL_BLOCK (cs_namecache)
+      {
+        ++nGeneration;
+        const EntryMap::iterator mi = entries.find (name);
+        if (mi != entries.end ())
+          {
+            lru.erase (mi->second.second);
+            entries.erase (mi);
+          }
+      }
+  }
+
+  void
+  GetStats (unsigned& nEntries, uint64& nHitsRet, uint64& nMissesRet)
+  {
+    CRITICAL_BLOCK (cs_namecache)
+      {
+        nEntries = entries.size ();
+        nHitsRet = nHits;
+        nMissesRet = nMisses;
+      }
+  }
 
-int
-CNameDB::ReadPrunedHeight ()
+};
+
+static CNameCache namecache;
+
+void
+GetNameCacheStats (unsigned& nEntries, uint64& nHits, uint64& nMisses)
 {
-  const std::string key("pruned");
+  namecache.GetStats (nEntries, nHits, nMisses);
+}
 
-  if (!Exists (key))
-    return -1;
+void
+CNameDB::Invalidate (const vchType& name)
+{
+  if (!vTxn.empty ())
+    setTxnChanged.insert (name);
+  namecache.Erase (name);
+}
 
-  int nHeight;
-  if (!Read (key, nHeight))
+bool
+CNameDB::TxnCommit ()
+{
+  const bool fOk = CDB::TxnCommit ();
+  if (vTxn.empty ())
     {
-      printf ("ERROR: ReadPrunedHeight: reading the name DB failed\n");
-      return -1;
+      BOOST_FOREACH(const vchType& name, setTxnChanged)
+        namecache.Erase (name);
+      setTxnChanged.clear ();
     }
 
-  return nHeight;
+  return fOk;
 }
 
 bool
-CNameDB::WritePrunedHeight (int nHeight)
+CNameDB::TxnAbort ()
 {
-  return Write (std::string ("pruned"), nHeight);
+  const bool fOk = CDB::TxnAbort ();
+  if (vTxn.empty ())
+    {
+      BOOST_FOREACH(const vchType& name, setTxnChanged)
+        namecache.Erase (name);
+      setTxnChanged.clear ();
+    }
+
+  return fOk;
 }
 
-void
+bool
+CNameDB::ReadName (const vchType& name, CNameIndex& nidx)
+{
+  /* Entries changed in our own open transaction are not yet committed.
+     The cache may still hold the old value for them, and the new one must
+     not be seen by others.  */
+  if (setTxnChanged.count (name) > 0)
+    return Read (LatestKey (name), nidx);
+
+  uint64 nGen;
+  if (namecache.Get (name, nidx, nGen))
+    return true;
+
+  if (!Read (LatestKey (name), nidx))
+    return false;
+  namecache.Set (name, nidx, nGen);
+
+  return true;
+}
+
+bool
+CNameDB::ExistsName (const vchType& name)
+{
+  CNameIndex nidx;
+  return ReadName (name, nidx);
+}
+
+Dbc*
+CNameDB::GetTxnCursor ()
+{
+  if (!pdb)
+    return NULL;
+
+  Dbc* pcursor = NULL;
+  if (pdb->cursor (GetTxn (), &pcursor, 0) != 0)
+    return NULL;
+
+  return pcursor;
+}
+
+bool
+CNameDB::ScanHistory (const vchType& name, unsigned nFrom,
+                      std::vector<unsigned>& vHeights,
+                      std::vector<CNameIndex>* vtxPos)
+{
+  vHeights.clear ();
+
+  Dbc* pcursor = GetTxnCursor ();
+  if (!pcursor)
+    return error ("CNameDB::ScanHistory: GetTxnCursor failed");
+
+  unsigned int fFlags = DB_SET_RANGE;
+  loop
+    {
+      CDataStream ssKey;
+      if (fFlags == DB_SET_RANGE)
+        ssKey << HistoryKey (name, nFrom);
+      CDataStream ssValue;
+      const int ret = ReadAtCursor (pcursor, ssKey, ssValue, fFlags);
+      fFlags = DB_NEXT;
+      if (ret == DB_NOTFOUND)
+        break;
+      if (ret != 0)
+        {
+          pcursor->close ();
+          return error ("CNameDB::ScanHistory: ReadAtCursor failed");
+        }
+
+      std::string strType;
+      ssKey >> strType;
+      if (strType != "nameh")
+        break;
+      CNameHistoryKey key;
+      ssKey >> key;
+      if (key.vchName != name)
+        break;
+
+      vHeights.push_back (key.GetHeight ());
+      if (vtxPos)
+        {
+          std::vector<CNameIndex> vec;
+          ssValue >> vec;
+          vtxPos->insert (vtxPos->end (), vec.begin (), vec.end ());
+        }
+    }
+  pcursor->close ();
+
+  return true;
+}
+
+bool
+CNameDB::ReadLastHistory (const vchType& name, unsigned nBefore,
+                          CNameIndex& nidx)
+{
+  Dbc* pcursor = GetTxnCursor ();
+  if (!pcursor)
+    return error ("CNameDB::ReadLastHistory: GetTxnCursor failed");
+
+  /* Position the cursor at the first record not before the given height
+     and step back from there.  If there is none, the last record in the
+     database may be the one we want.  */
+  CDataStream ssKey;
+  ssKey << HistoryKey (name, nBefore);
+  CDataStream ssValue;
+  int ret = ReadAtCursor (pcursor, ssKey, ssValue, DB_SET_RANGE);
+  if (ret == 0)
+    ret = ReadAtCursor (pcursor, ssKey, ssValue, DB_PREV);
+  else if (ret == DB_NOTFOUND)
+    ret = ReadAtCursor (pcursor, ssKey, ssValue, DB_LAST);
+  pcursor->close ();
+  if (ret != 0)
+    return false;
+
+  std::string strType;
+  ssKey >> strType;
+  if (strType != "nameh")
+    return false;
+  CNameHistoryKey key;
+  ssKey >> key;
+  if (key.vchName != name)
+    return false;
+
+  std::vector<CNameIndex> vec;
+  ssValue >> vec;
+  if (vec.empty ())
+    return false;
+
+  nidx = vec.back ();
+  return true;
+}
+
+bool
+CNameDB::EraseName (const vchType& name)
+{
+  std::vector<unsigned> vHeights;
+  if (!ScanHistory (name, 0, vHeights, NULL))
+    return false;
+
+  BOOST_FOREACH(unsigned h, vHeights)
+    Erase (HistoryKey (name, h));
+
+  Invalidate (name);
+  return Erase (LatestKey (name));
+}
+
+bool
+CNameDB::PushEntry (const vchType& name, const CNameIndex& value)
+{
+  std::vector<CNameIndex> vec;
+  const std::pair<std::string, CNameHistoryKey> key
+    = HistoryKey (name, value.nHeight);
+  if (Exists (key) && !Read (key, vec))
+    return error ("CNameDB::PushEntry: reading history failed");
+
+  vec.push_back (value);
+  if (!Write (key, vec))
+    return false;
+
+  Invalidate (name);
+  return Write (LatestKey (name), value);
+}
+
+bool
+CNameDB::PopEntry (const vchType& name, int nHeight)
+{
+  /* Ensure that we don't pop across already pruned entries.  We need that
+     the remaining height (nHeight - 1) is not yet pruned (i. e., at least
+     than prunedHeight).  */
+  const int prunedHeight = ReadPrunedHeight ();
+  if (nHeight - 1 < prunedHeight)
+    return error ("CNameDB::PopEntry: height %d already pruned (up to %d)",
+                  nHeight, prunedHeight);
+
+  /* If the name doesn't exist, there's nothing to pop.  */
+  CNameIndex latest;
+  if (!ReadName (name, latest))
+    {
+      printf ("CNameDB::PopEntry: warning, name not in DB\n");
+      return true;
+    }
+
+  if (latest.nHeight != nHeight)
+    printf ("CNameDB::PopEntry: warning, height mismatch (%d, expected %d)\n",
+            latest.nHeight, nHeight);
+
+  Invalidate (name);
+
+  std::vector<unsigned> vHeights;
+  if (!ScanHistory (name, nHeight, vHeights, NULL))
+    return error ("CNameDB::PopEntry: ScanHistory failed");
+  BOOST_FOREACH(unsigned h, vHeights)
+    if (!Erase (HistoryKey (name, h)))
+      return error ("CNameDB::PopEntry: failed to erase history");
+
+  CNameIndex prev;
+  if (!ReadLastHistory (name, nHeight, prev))
+    return Erase (LatestKey (name));
+
+  return Write (LatestKey (name), prev);
+}
+
+bool
+CNameDB::Upgrade ()
+{
+  /* Collect the names still in the old format first, so that we do not
+     write while reading from the cursor.  */
+  Dbc* pcursor = GetTxnCursor ();
+  if (!pcursor)
+    return error ("CNameDB::Upgrade: GetTxnCursor failed");
+
+  std::vector<vchType> names;
+  unsigned int fFlags = DB_SET_RANGE;
+  loop
+    {
+      CDataStream ssKey;
+      if (fFlags == DB_SET_RANGE)
+        ssKey << std::make_pair (std::string ("namei"), vchType ());
+      CDataStream ssValue;
+      const int ret = ReadAtCursor (pcursor, ssKey, ssValue, fFlags);
+      fFlags = DB_NEXT;
+      if (ret == DB_NOTFOUND)
+        break;
+      if (ret != 0)
+        {
+          pcursor->close ();
+          return error ("CNameDB::Upgrade: ReadAtCursor failed");
+        }
+
+      std::string strType;
+      ssKey >> strType;
+      if (strType != "namei")
+        break;
+      vchType vchName;
+      ssKey >> vchName;
+      names.push_back (vchName);
+    }
+  pcursor->close ();
+
+  if (names.empty ())
+    return true;
+
+  /* Each name is converted together with the removal of its old record,
+     so that an interrupted upgrade can simply be continued.  */
+  printf ("Updating the name index for %u names...\n",
+          static_cast<unsigned> (names.size ()));
+  for (unsigned i = 0; i < names.size (); ++i)
+    {
+      if (i % 1000 == 0)
+        {
+          if (i > 0 && !TxnCommit ())
+            return error ("CNameDB::Upgrade: TxnCommit failed");
+          TxnBegin ();
+        }
+
+      const std::pair<std::string, vchType> oldKey("namei", names[i]);
+      std::vector<CNameIndex> vec;
+      if (!Read (oldKey, vec))
+        {
+          TxnAbort ();
+          return error ("CNameDB::Upgrade: failed to read '%s'",
+                        stringFromVch (names[i]).c_str ());
+        }
+
+      std::map<unsigned, std::vector<CNameIndex> > byHeight;
+      BOOST_FOREACH(const CNameIndex& nidx, vec)
+        byHeight[nidx.nHeight].push_back (nidx);
+
+      typedef std::pair<const unsigned, std::vector<CNameIndex> > HeightPair;
+      BOOST_FOREACH(const HeightPair& item, byHeight)
+        if (!Write (HistoryKey (names[i], item.first), item.second))
+          {
+            TxnAbort ();
+            return error ("CNameDB::Upgrade: writing history failed");
+          }
+      if (!vec.empty () && !Write (LatestKey (names[i]), vec.back ()))
+        {
+          TxnAbort ();
+          return error ("CNameDB::Upgrade: writing latest entry failed");
+        }
+      Erase (oldKey);
+    }
+  if (!TxnCommit ())
+    return error ("CNameDB::Upgrade: TxnCommit failed");
+
+  printf ("Name index updated\n");
+  return true;
+}
+
+int
+CNameDB::ReadPrunedHeight ()
+{
+  const std::string key("pruned");
+
+  if (!Exists (key))
+    return -1;
+
+  int nHeight;
+  if (!Read (key, nHeight))
+    {
+      printf ("ERROR: ReadPrunedHeight: reading the name DB failed\n");
+      return -1;
+    }
+
+  return nHeight;
+}
+
+bool
+CNameDB::WritePrunedHeight (int nHeight)
+{
+  return Write (std::string ("pruned"), nHeight);
+}
+
+void
 CNameDB::Prune (unsigned nHeight)
 {
   /* In a first step, we iterate over the DB and extract a list of names
      to process.  Afterwards, we process each name and prune it.  This prevents
-     problems due to iterator invalidation.  It should also not use as
-     much memory as keeping the full "in work" nameindex in memory.  */
+     problems due to iterator invalidation.  */
 
-  Dbc* pcursor = GetCursor ();
+  Dbc* pcursor = GetTxnCursor ();
   if (!pcursor)
     {
-      printf ("ERROR: CNameDB::Prune: GetCursor failed\n");
+      printf ("ERROR: CNameDB::Prune: GetTxnCursor failed\n");
       return;
     }
 
-  std::set<vchType> names;
+  std::map<vchType, CNameIndex> names;
   unsigned int fFlags = DB_SET_RANGE;
   loop
     {
       // Read next record
       CDataStream ssKey;
       if (fFlags == DB_SET_RANGE)
-        ssKey << std::make_pair (std::string("namei"), vchType());
+        ssKey << LatestKey (vchType ());
       CDataStream ssValue;
       const int ret = ReadAtCursor (pcursor, ssKey, ssValue, fFlags);
       fFlags = DB_NEXT;
@@ -868,18 +1822,20 @@ CNameDB::Prune (unsigned nHeight)
       if (ret != 0)
         {
           printf ("ERROR: CNameDB::Prune: ReadAtCursor failed\n");
+          pcursor->close ();
           return;
         }
 
       // Unserialize
       string strType;
       ssKey >> strType;
-      if (strType == "namei")
-        {
-          vchType vchName;
-          ssKey >> vchName;
-          names.insert (vchName);
-        }
+      if (strType != "namel")
+        break;
+      vchType vchName;
+      ssKey >> vchName;
+      CNameIndex nidx;
+      ssValue >> nidx;
+      names.insert (std::make_pair (vchName, nidx));
     }
   pcursor->close ();
 
@@ -896,21 +1852,15 @@ CNameDB::Prune (unsigned nHeight)
   unsigned nNames = 0;
   unsigned nNamesPruned = 0;
   const vchType vchDead = vchFromString (VALUE_DEAD);
-  BOOST_FOREACH(const vchType& name, names)
+  typedef std::pair<const vchType, CNameIndex> NamePair;
+  BOOST_FOREACH(const NamePair& item, names)
     {
-      std::vector<CNameIndex> vec;
-      if (!ReadNameVec (name, vec))
-        {
-          printf ("WARNING: CNameDB::Prune: ReadNameVec failed, continuing\n");
-          nEntries += vec.size ();
-          ++nNames;
-          continue;
-        }
+      const vchType& name = item.first;
+      const CNameIndex& latest = item.second;
 
       /* If the last entry is a death and it is long enough ago,
          remove the name entirely.  */
-      if (vec.back ().vValue == vchFromString (VALUE_DEAD)
-          && vec.back ().nHeight < nHeight)
+      if (latest.vValue == vchDead && latest.nHeight < nHeight)
         {
           ++nNamesPruned;
           EraseName (name);
@@ -918,15 +1868,32 @@ CNameDB::Prune (unsigned nHeight)
         }
       ++nNames;
 
-      /* Remove everything too old.  */
-      std::vector<CNameIndex> vecNew;
-      for (unsigned i = 0; i < vec.size (); ++i)
-        if (vec[i].nHeight >= nHeight || i + 1 == vec.size ())
-          vecNew.push_back (vec[i]);
+      std::vector<unsigned> vHeights;
+      if (!ScanHistory (name, 0, vHeights, NULL))
+        {
+          printf ("WARNING: CNameDB::Prune: ScanHistory failed, continuing\n");
+          continue;
+        }
 
-      nEntries += vecNew.size ();
-      nPruned += vec.size () - vecNew.size ();
-      WriteName (name, vecNew);
+      /* Remove everything too old, except for the latest entry.  */
+      BOOST_FOREACH(unsigned h, vHeights)
+        {
+          if (h >= nHeight)
+            {
+              ++nEntries;
+              continue;
+            }
+
+          if (h == latest.nHeight)
+            {
+              ++nEntries;
+              Write (HistoryKey (name, h), std::vector<CNameIndex> (1, latest));
+              continue;
+            }
+
+          ++nPruned;
+          Erase (HistoryKey (name, h));
+        }
     }
 
   printf ("Pruned nameindex:\n"
@@ -939,15 +1906,373 @@ CNameDB::Prune (unsigned nHeight)
 /* ************************************************************************** */
 /* CUtxoDB.  */
 
+int64 nUtxoCacheSize = 64 << 20;
+
+/* Changes to the UTXO set that are not yet in the database.  */
+struct CUtxoCacheEntry
+{
+  CUtxoEntry txo;
+  /* The output has been spent, i. e., it must be erased.  */
+  bool fSpent;
+  /* The output is not present in the layers below (the database and,
+     for a DB transaction's changes, the shared cache).  Such an entry
+     can be dropped completely when it is spent again.  */
+  bool fFresh;
+};
+
+class CUtxoCacheLayer
+{
+public:
+
+  typedef std::map<COutPoint, CUtxoCacheEntry> EntryMap;
+  EntryMap entries;
+
+  /* Estimated memory used by the entries.  */
+  size_t nBytes;
+
+  inline CUtxoCacheLayer ()
+    : nBytes(0)
+  {}
+
+  static inline size_t
+  EntrySize (const CUtxoCacheEntry& entry)
+  {
+    /* The map node plus the script data.  */
+    return sizeof (EntryMap::value_type) + 4 * sizeof (void*)
+            + entry.txo.txo.scriptPubKey.size ();
+  }
+
+  inline bool
+  Find (const COutPoint& pos, CUtxoCacheEntry& entry) const
+  {
+    const EntryMap::const_iterator mi = entries.find (pos);
+    if (mi == entries.end ())
+      return false;
+    entry = mi->second;
+    return true;
+  }
+
+  /* Apply a change on top of this layer.  The fFresh flag of the change
+     refers to the layers below this one.  */
+  void Apply (const COutPoint& pos, const CUtxoCacheEntry& change);
+
+  inline void
+  Clear ()
+  {
+    entries.clear ();
+    nBytes = 0;
+  }
+
+};
+
+void
+CUtxoCacheLayer::Apply (const COutPoint& pos, const CUtxoCacheEntry& change)
+{
+  const EntryMap::iterator mi = entries.find (pos);
+  if (mi == entries.end ())
+    {
+      /* Creating and spending an output in between flushes
+         need not touch the database at all.  */
+      if (change.fSpent && change.fFresh)
+        return;
+
+      entries.insert (std::make_pair (pos, change));
+      nBytes += EntrySize (change);
+      return;
+    }
+
+  CUtxoCacheEntry& entry = mi->second;
+  nBytes -= EntrySize (entry);
+  if (change.fSpent && entry.fFresh)
+    {
+      entries.erase (mi);
+      return;
+    }
+
+  const bool fFresh = entry.fFresh;
+  entry = change;
+  entry.fFresh = fFresh;
+  nBytes += EntrySize (entry);
+}
+
+/* The shared cache holds committed changes that are not yet written
+   to the database.  It is written out every UTXO_CACHE_FLUSH_BLOCKS
+   blocks, when it grows larger than nUtxoCacheSize or when a block
+   is disconnected.  */
+static const unsigned UTXO_CACHE_FLUSH_BLOCKS = 1000;
+static CCriticalSection cs_utxocache;
+static CUtxoCacheLayer utxoCache;
+static unsigned nUtxoCacheBlocks = 0;
+static bool fUtxoCacheFlushNow = false;
+/* Whether the database is known to have a "bestblock" entry.  Until it
+   has one, the cache is written out with every DB transaction.  */
+static bool fUtxoHaveBestBlock = false;
+
+bool
+FlushUtxoCache ()
+{
+  CRITICAL_BLOCK (cs_utxocache)
+    {
+      if (utxoCache.entries.empty ())
+        return true;
+      fUtxoCacheFlushNow = true;
+    }
+
+  CCriticalBlock lock(cs_main);
+  printf ("Writing out the UTXO cache...\n");
+
+  DatabaseSet dbset("r+");
+  if (!dbset.TxnBegin ())
+    return false;
+  return dbset.TxnCommit ();
+}
+
+CUtxoDB::CUtxoDB (const char* pszMode, bool fCachedIn)
+  : CDB("utxo.dat", pszMode, false), fCached(fCachedIn),
+    pTxnChanges(new CUtxoCacheLayer ()),
+    fTxnDisconnect(false), fTxnFlushed(false)
+{}
+
+CUtxoDB::~CUtxoDB ()
+{
+  delete pTxnChanges;
+}
+
 CUtxoDB::KeyType
 CUtxoDB::GetKey (const COutPoint& pos)
 {
   return std::make_pair (std::string ("txo"), pos);
 }
 
+bool
+CUtxoDB::WriteCacheVersion ()
+{
+  return Write (std::string ("cacheversion"), VERSION);
+}
+
+bool
+CUtxoDB::WriteBestBlock (const uint256& hash)
+{
+  return Write (std::string ("bestblock"), hash) && WriteCacheVersion ();
+}
+
+bool
+CUtxoDB::ClearUtxos ()
+{
+  std::vector<COutPoint> vPos;
+
+  Dbc* pcursor = GetCursor ();
+  if (!pcursor)
+    return error ("ClearUtxos: failed to get DB cursor");
+
+  unsigned int fFlags = DB_SET_RANGE;
+  while (true)
+    {
+      CDataStream ssKey;
+      if (fFlags == DB_SET_RANGE)
+        {
+          COutPoint p(uint256 (0), 0);
+          ssKey << GetKey (p);
+        }
+      CDataStream ssValue;
+      const int ret = ReadAtCursor (pcursor, ssKey, ssValue, fFlags);
+      fFlags = DB_NEXT;
+      if (ret == DB_NOTFOUND)
+        break;
+      if (ret != 0)
+        {
+          pcursor->close ();
+          return error ("ClearUtxos: ReadAtCursor failed");
+        }
+
+      std::string strType;
+      ssKey >> strType;
+      if (strType != "txo")
+        break;
+
+      COutPoint pos;
+      ssKey >> pos;
+      vPos.push_back (pos);
+    }
+  pcursor->close ();
+
+  printf ("Removing %u entries from the UTXO database...\n",
+          static_cast<unsigned> (vPos.size ()));
+  for (unsigned i = 0; i < vPos.size (); i += 10000)
+    {
+      TxnBegin ();
+      const unsigned end = std::min<unsigned> (vPos.size (), i + 10000);
+      for (unsigned j = i; j < end; ++j)
+        if (!Erase (GetKey (vPos[j])))
+          {
+            TxnAbort ();
+            return error ("ClearUtxos: Erase failed");
+          }
+      if (!TxnCommit ())
+        return error ("ClearUtxos: TxnCommit failed");
+    }
+
+  return true;
+}
+
+bool
+CUtxoDB::FindCached (const COutPoint& pos, CUtxoCacheEntry& entry,
+                     bool* pfTxnLayer)
+{
+  if (!fCached)
+    return false;
+
+  if (!vTxn.empty () && pTxnChanges->Find (pos, entry))
+    {
+      if (pfTxnLayer)
+        *pfTxnLayer = true;
+      return true;
+    }
+
+  CRITICAL_BLOCK (cs_utxocache)
+    if (utxoCache.Find (pos, entry))
+      {
+        if (pfTxnLayer)
+          *pfTxnLayer = false;
+        return true;
+      }
+
+  return false;
+}
+
+void
+CUtxoDB::Change (const COutPoint& pos, const CUtxoCacheEntry& change)
+{
+  if (!vTxn.empty ())
+    {
+      pTxnChanges->Apply (pos, change);
+      return;
+    }
+
+  CRITICAL_BLOCK (cs_utxocache)
+    utxoCache.Apply (pos, change);
+}
+
+bool
+CUtxoDB::WriteLayer (const CUtxoCacheLayer& layer)
+{
+  BOOST_FOREACH (const PAIRTYPE(const COutPoint, CUtxoCacheEntry)& item,
+                 layer.entries)
+    {
+      if (item.second.fSpent)
+        {
+          /* The entry may be missing if it was only created in the layer
+             below.  That is fine.  */
+          Erase (GetKey (item.first));
+        }
+      else if (!Write (GetKey (item.first), item.second.txo))
+        return false;
+    }
+
+  return true;
+}
+
+bool
+CUtxoDB::PrepareCommit (CTxDB& txdb)
+{
+  fTxnFlushed = false;
+  if (!fCached || fReadOnly || vTxn.empty ())
+    return true;
+
+  CRITICAL_BLOCK (cs_utxocache)
+    {
+      const size_t nBytes = utxoCache.nBytes + pTxnChanges->nBytes;
+      /* A freshly created UTXO set (with the genesis block) must be
+         marked as such right away, since CatchUp can not tell how far
+         it got otherwise.  */
+      bool fFirst = false;
+      if (!fUtxoHaveBestBlock)
+        {
+          fFirst = !Exists (std::string ("bestblock"));
+          fUtxoHaveBestBlock = !fFirst;
+        }
+
+      const bool fFlush = (fFirst || fTxnDisconnect || fUtxoCacheFlushNow
+                           || nUtxoCacheSize <= 0
+                           || nBytes > static_cast<uint64> (nUtxoCacheSize)
+                           || nUtxoCacheBlocks + 1 >= UTXO_CACHE_FLUSH_BLOCKS);
+      if (!fFlush)
+        return true;
+      if (!fFirst && utxoCache.entries.empty ()
+          && pTxnChanges->entries.empty ())
+        return true;
+
+      uint256 hashBest;
+      if (!txdb.ReadHashBestChain (hashBest))
+        return error ("PrepareCommit: failed to read best chain hash");
+
+      if (!WriteLayer (utxoCache) || !WriteLayer (*pTxnChanges))
+        return false;
+      if (!WriteBestBlock (hashBest))
+        return false;
+
+      fTxnFlushed = true;
+    }
+
+  return true;
+}
+
+void
+CUtxoDB::FinishCommit (bool fOk)
+{
+  if (!fCached)
+    return;
+
+  CRITICAL_BLOCK (cs_utxocache)
+    if (fOk)
+      {
+        if (fTxnFlushed)
+          {
+            if (fDebug)
+              printf ("Flushed UTXO cache: %u entries\n",
+                      static_cast<unsigned> (utxoCache.entries.size ()
+                                             + pTxnChanges->entries.size ()));
+            utxoCache.Clear ();
+            nUtxoCacheBlocks = 0;
+            fUtxoCacheFlushNow = false;
+            fUtxoHaveBestBlock = true;
+          }
+        else if (!pTxnChanges->entries.empty ())
+          {
+            BOOST_FOREACH (const PAIRTYPE(const COutPoint, CUtxoCacheEntry)& item,
+                           pTxnChanges->entries)
+              utxoCache.Apply (item.first, item.second);
+            ++nUtxoCacheBlocks;
+          }
+      }
+
+  pTxnChanges->Clear ();
+  fTxnDisconnect = false;
+  fTxnFlushed = false;
+}
+
+bool
+CUtxoDB::TxnAbort ()
+{
+  pTxnChanges->Clear ();
+  fTxnDisconnect = false;
+  fTxnFlushed = false;
+
+  return CDB::TxnAbort ();
+}
+
 bool
 CUtxoDB::ReadUtxo (const COutPoint& pos, CUtxoEntry& txo)
 {
+  CUtxoCacheEntry cached;
+  if (FindCached (pos, cached))
+    {
+      if (cached.fSpent)
+        return false;
+      txo = cached.txo;
+      return true;
+    }
+
   return Read (GetKey (pos), txo);
 }
 
@@ -961,7 +2286,34 @@ CUtxoDB::InsertUtxo (const COutPoint& pos, const CUtxoEntry& txo)
       return true;
     }
 
-  if (Exists (GetKey (pos)))
+  /* With the cache, the database is only asked for an existing entry in
+     case of coinbase and game transactions.  Other transactions can not
+     be duplicates, since their inputs are already spent.  */
+  CUtxoCacheEntry cached;
+  CUtxoEntry existing;
+  bool fExists, fFresh, fTxnLayer;
+  if (FindCached (pos, cached, &fTxnLayer))
+    {
+      /* Only an entry in our own transaction layer is known to be merged
+         or written together with this change.  One from the shared cache
+         may already be on disk once our layer is written.  */
+      fExists = !cached.fSpent;
+      fFresh = (fTxnLayer && cached.fFresh);
+      if (fExists)
+        existing = cached.txo;
+    }
+  else if (!fCached || txo.isCoinbase || txo.isGameTx)
+    {
+      fExists = Read (GetKey (pos), existing);
+      fFresh = !fExists;
+    }
+  else
+    {
+      fExists = false;
+      fFresh = true;
+    }
+
+  if (fExists)
     {
       printf ("Already existing in UTXO: %s\n", pos.ToString ().c_str ());
 
@@ -982,8 +2334,6 @@ CUtxoDB::InsertUtxo (const COutPoint& pos, const CUtxoEntry& txo)
       if (!txo.isCoinbase)
         return error ("Duplicate UTXO entry is not coinbase!");
 
-      CUtxoEntry existing;
-      ReadUtxo (pos, existing);
       if (existing.height >= txo.height)
         {
           /* When recreating the UTXO set from the chain, we process the
@@ -995,7 +2345,16 @@ CUtxoDB::InsertUtxo (const COutPoint& pos, const CUtxoEntry& txo)
         }
     }
 
-  return Write (GetKey (pos), txo);
+  if (!fCached)
+    return Write (GetKey (pos), txo);
+
+  CUtxoCacheEntry change;
+  change.txo = txo;
+  change.fSpent = false;
+  change.fFresh = fFresh;
+  Change (pos, change);
+
+  return true;
 }
 
 bool
@@ -1023,21 +2382,38 @@ CUtxoDB::InsertUtxo (const CTransaction& tx, int height)
 bool
 CUtxoDB::RemoveUtxo (const COutPoint& pos)
 {
-  if (!Exists (GetKey (pos)))
+  CUtxoCacheEntry cached;
+  bool fExists;
+  if (FindCached (pos, cached))
+    fExists = !cached.fSpent;
+  else
+    fExists = Exists (GetKey (pos));
+  if (!fExists)
     return error ("Trying to remove non-existant UTXO entry.");
 
-  return Erase (GetKey (pos));
+  if (!fCached)
+    return Erase (GetKey (pos));
+
+  CUtxoCacheEntry change;
+  change.fSpent = true;
+  change.fFresh = false;
+  Change (pos, change);
+
+  return true;
 }
 
 bool
 CUtxoDB::RemoveUtxo (const CTransaction& tx)
 {
+  fTxnDisconnect = true;
+
   const uint256 hash = tx.GetHash ();
   for (unsigned n = 0; n < tx.vout.size (); ++n)
     {
       COutPoint pos(hash, n);
+      CUtxoEntry dummy;
       if (tx.vout[n].IsUnspendable ())
-        assert (!Exists (GetKey (pos)));
+        assert (!ReadUtxo (pos, dummy));
       else if (!RemoveUtxo (pos))
         return false;
     }
@@ -1181,6 +2557,22 @@ CUtxoDB::InternalRescan (bool fVerify, OutPointSet* outPoints)
         TxnCommit ();
     }
 
+  /* Only now the UTXO set matches the best chain.  Should we crash before,
+     CatchUp finds the "bestblock" entry missing and starts over.  */
+  if (!fVerify)
+    {
+      TxnBegin ();
+      if (!WriteBestBlock (hashBestChain))
+        {
+          TxnAbort ();
+          return error ("InternalRescan: failed to write best block");
+        }
+      if (!TxnCommit ())
+        return error ("InternalRescan: failed to commit best block");
+      CRITICAL_BLOCK (cs_utxocache)
+        fUtxoHaveBestBlock = true;
+    }
+
   printf ("Finished constructing UTXO.\n"
           "  # txo:       %d\n"
           "  # tx:        %d\n"
@@ -1209,6 +2601,9 @@ CUtxoDB::Verify ()
   CCriticalBlock lock(cs_main);
   OutPointSet outPoints;
 
+  if (!FlushUtxoCache ())
+    return false;
+
   /* In a first pass, the blockchain is read and it is checked that
      every UTXO found is part of the DB.  We keep track of all COutPoints
      that appear.  Later, go through everything in the DB and check that
@@ -1271,6 +2666,9 @@ CUtxoDB::Analyse (unsigned& nUtxo, int64_t& amount, int64_t& inNames)
   amount = 0;
   inNames = 0;
 
+  if (!FlushUtxoCache ())
+    return false;
+
   Dbc* pcursor = GetCursor ();
   if (!pcursor)
     return error ("Failed to get DB cursor.");
@@ -1321,10 +2719,98 @@ CUtxoDB::GetUtxoSet (OutPointSet& res)
 {
   CCriticalBlock lock(cs_main);
 
+  if (!FlushUtxoCache ())
+    return false;
+
   res.clear ();
   return InternalRescan (true, &res);
 }
 
+bool
+CUtxoDB::CatchUp ()
+{
+  assert (!fCached);
+
+  uint256 hashUtxo;
+  if (!Read (std::string ("bestblock"), hashUtxo))
+    {
+      /* A UTXO set created with the cache has the "cacheversion" entry.
+         If it has no best block, it is either new or a rebuild has been
+         interrupted, so build it (again) from the chain.  */
+      int nCacheVersion;
+      if (Read (std::string ("cacheversion"), nCacheVersion))
+        {
+          printf ("The UTXO set is incomplete, rebuilding it...\n");
+          if (!ClearUtxos ())
+            return false;
+          return Rescan ();
+        }
+
+      /* Otherwise it has been written by an older version without the
+         cache and matches the best chain.  Mark it as upgraded.  */
+      printf ("Upgrading the UTXO set for the cache...\n");
+      TxnBegin ();
+      if (!WriteBestBlock (hashBestChain))
+        {
+          TxnAbort ();
+          return error ("CatchUp: failed to write best block");
+        }
+      if (!TxnCommit ())
+        return false;
+      CRITICAL_BLOCK (cs_utxocache)
+        fUtxoHaveBestBlock = true;
+      return true;
+    }
+
+  CRITICAL_BLOCK (cs_utxocache)
+    fUtxoHaveBestBlock = true;
+  if (hashUtxo == hashBestChain)
+    return true;
+
+  const BlockMap::const_iterator mi = mapBlockIndex.find (hashUtxo);
+  if (mi == mapBlockIndex.end ()
+      || pindexBest->GetAncestor (mi->second->nHeight) != mi->second)
+    return error ("The UTXO set is not for a block in the main chain."
+                  "  Remove utxo.dat to rebuild it.");
+
+  printf ("Updating the UTXO set from height %d to %d...\n",
+          mi->second->nHeight, nBestHeight);
+  for (int h = mi->second->nHeight + 1; h <= nBestHeight; ++h)
+    {
+      const CBlockIndex* pindex = pindexBest->GetAncestor (h);
+      CBlock block;
+      if (!block.ReadFromDisk (pindex))
+        return error ("CatchUp: failed to read block at height %d", h);
+
+      std::vector<const CTransaction*> vTxs;
+      for (unsigned i = 0; i < block.vtx.size (); ++i)
+        vTxs.push_back (&block.vtx[i]);
+      for (unsigned i = 0; i < block.vgametx.size (); ++i)
+        vTxs.push_back (&block.vgametx[i]);
+
+      TxnBegin ();
+      BOOST_FOREACH (const CTransaction* tx, vTxs)
+        {
+          BOOST_FOREACH (const CTxIn& txin, tx->vin)
+            if (!txin.prevout.IsNull () && !RemoveUtxo (txin.prevout))
+              {
+                TxnAbort ();
+                return error ("CatchUp: RemoveUtxo failed at height %d", h);
+              }
+          if (!InsertUtxo (*tx, h))
+            {
+              TxnAbort ();
+              return error ("CatchUp: InsertUtxo failed at height %d", h);
+            }
+        }
+      if (!Write (std::string ("bestblock"), *pindex->phashBlock)
+          || !TxnCommit ())
+        return error ("CatchUp: failed to commit height %d", h);
+    }
+
+  return true;
+}
+
 /* ************************************************************************** */
 
 //
@@ -1440,6 +2926,9 @@ void ThreadFlushWalletDB(void* parg)
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
+            // Pooled read handles would keep the files in use
+            CloseReadDatabaseSets();
+
             TRY_CRITICAL_BLOCK(cs_db)
             {
                 // Don't do this if any databases are in use
@@ -1475,6 +2964,143 @@ void ThreadFlushWalletDB(void* parg)
     }
 }
 
+static CCriticalSection cs_dbmaintstats;
+static CDBMaintenanceStats dbmaintstats;
+
+void GetDBMaintenanceStats(CDBMaintenanceStats& stats)
+{
+    CRITICAL_BLOCK(cs_dbmaintstats)
+        stats = dbmaintstats;
+}
+
+// One round of maintenance:  write out dirty cache pages in the background,
+// checkpoint when enough log has been written or enough time has passed and
+// collect statistics.  cs_dbmaint must be held.
+static void DoDBMaintenance(uint64 nLogBudget, int64 nInterval, int nTricklePercent, int64& nLastCheckpoint)
+{
+    DB_LOG_STAT* plogstat = NULL;
+    dbenv.log_stat(&plogstat, 0);
+    uint64 nSinceCheckpoint = 0;
+    if (plogstat)
+    {
+        nSinceCheckpoint = (uint64)plogstat->st_wc_mbytes * 1048576 + plogstat->st_wc_bytes;
+        free(plogstat);
+    }
+
+    // Keep a share of the cache clean, so that the checkpoint has less to
+    // write when it comes.  Be more aggressive when one is due soon.
+    int nPercent = nTricklePercent;
+    if (nSinceCheckpoint * 2 >= nLogBudget)
+        nPercent = std::min(100, 2 * nPercent);
+    int nWrote = 0;
+    if (nPercent > 0)
+        dbenv.memp_trickle(nPercent, &nWrote);
+
+    const int64 nNow = GetTime();
+    int64 nCheckpointMillis = -1;
+    if (nSinceCheckpoint >= nLogBudget || (nSinceCheckpoint > 0 && nNow - nLastCheckpoint >= nInterval))
+    {
+        const int64 nStart = GetTimeMillis();
+        dbenv.txn_checkpoint(0, 0, 0);
+        nCheckpointMillis = GetTimeMillis() - nStart;
+        nLastCheckpoint = nNow;
+        nSinceCheckpoint = 0;
+        if (fDebug)
+            printf("ThreadDBMaintenance: checkpoint took %"PRI64d"ms\n", nCheckpointMillis);
+    }
+
+    // Old log files are removed automatically (DB_LOG_AUTO_REMOVE) once
+    // they are no longer needed after a checkpoint; report what is left.
+    uint64 nLogBytes = 0;
+    int nLogFiles = 0;
+    char** listp = NULL;
+    if (dbenv.log_archive(&listp, DB_ARCH_ABS | DB_ARCH_LOG) == 0 && listp)
+    {
+        for (char** lp = listp; *lp; ++lp)
+        {
+            ++nLogFiles;
+            try
+            {
+                nLogBytes += filesystem::file_size(*lp);
+            }
+            catch (const filesystem::filesystem_error& e)
+            {
+                // The file may just have been removed
+            }
+        }
+        free(listp);
+    }
+
+    DB_MPOOL_STAT* pmpstat = NULL;
+    dbenv.memp_stat(&pmpstat, NULL, 0);
+
+    CRITICAL_BLOCK(cs_dbmaintstats)
+    {
+        if (nCheckpointMillis >= 0)
+        {
+            ++dbmaintstats.nCheckpoints;
+            dbmaintstats.nLastCheckpointTime = nNow;
+            dbmaintstats.nLastCheckpointMillis = nCheckpointMillis;
+            dbmaintstats.nMaxCheckpointMillis = std::max(dbmaintstats.nMaxCheckpointMillis, nCheckpointMillis);
+            dbmaintstats.nTotalCheckpointMillis += nCheckpointMillis;
+        }
+        dbmaintstats.nLogBytes = nLogBytes;
+        dbmaintstats.nLogFiles = nLogFiles;
+        dbmaintstats.nLogBytesSinceCheckpoint = nSinceCheckpoint;
+        dbmaintstats.nPagesTrickled += nWrote;
+        if (pmpstat)
+        {
+            dbmaintstats.nCacheHits = pmpstat->st_cache_hit;
+            dbmaintstats.nCacheMisses = pmpstat->st_cache_miss;
+            dbmaintstats.nPages = pmpstat->st_pages;
+            dbmaintstats.nPagesDirty = pmpstat->st_page_dirty;
+        }
+    }
+    if (pmpstat)
+        free(pmpstat);
+}
+
+void ThreadDBMaintenance(void* parg)
+{
+    printf("ThreadDBMaintenance started\n");
+
+    const uint64 nLogBudget = (uint64)GetArg("-dblogsize", 100) << 20;
+    const int64 nInterval = GetArg("-dbcheckpointmins", 2) * 60;
+    const int nTricklePercent = GetArg("-dbtrickle", 10);
+
+    CRITICAL_BLOCK(cs_dbmaintstats)
+        memset(&dbmaintstats, 0, sizeof(dbmaintstats));
+    fDBMaintenanceRunning = true;
+
+    int64 nLastCheckpoint = GetTime();
+    int64 nLastRun = 0;
+    while (!fShutdown)
+    {
+        MilliSleep(1000);
+        if (GetTime() - nLastRun < 10)
+            continue;
+        nLastRun = GetTime();
+
+        CRITICAL_BLOCK(cs_dbmaint)
+        {
+            if (fDbEnvInit && !fShutdown)
+            {
+                try
+                {
+                    DoDBMaintenance(nLogBudget, nInterval, nTricklePercent, nLastCheckpoint);
+                }
+                catch (const DbException& e)
+                {
+                    printf("ThreadDBMaintenance: %s (%d)\n", e.what(), e.get_errno());
+                }
+            }
+        }
+    }
+
+    fDBMaintenanceRunning = false;
+    printf("ThreadDBMaintenance exiting\n");
+}
+
 bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
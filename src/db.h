@@ -33,8 +33,46 @@ extern bool fDetachDB;
 
 extern void DBFlush(bool fShutdown);
 void ThreadFlushWalletDB(void* parg);
+void ThreadDBMaintenance(void* parg);
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
 void PrintSettingsToLog();
+bool WriteBlockIndexSnapshot();
+void BenchmarkDBReads();
+
+// Whether checkpoints of the database environment are left to
+// ThreadDBMaintenance instead of being done when closing a database
+extern bool fDBMaintenance;
+
+// Activity of the database maintenance thread
+struct CDBMaintenanceStats
+{
+    int nCheckpoints;
+    int64 nLastCheckpointTime;
+    int64 nLastCheckpointMillis;
+    int64 nMaxCheckpointMillis;
+    int64 nTotalCheckpointMillis;
+    uint64 nLogBytes;
+    int nLogFiles;
+    uint64 nLogBytesSinceCheckpoint;
+    uint64 nCacheHits;
+    uint64 nCacheMisses;
+    uint64 nPages;
+    uint64 nPagesDirty;
+    uint64 nPagesTrickled;
+};
+void GetDBMaintenanceStats(CDBMaintenanceStats& stats);
+
+/* Serialisation buffers reused by the CDB methods of databases that do not
+   hold secrets.  There is one set of them per thread.  */
+struct CDBBuffers
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    std::vector<char> vchData;
+
+    CDBBuffers() : ssKey(SER_DISK), ssValue(SER_DISK) {}
+};
+CDBBuffers& GetDBBuffers();
 
 
 
@@ -57,7 +95,13 @@ protected:
        for serialisation on the streams.  */
     int nVersion;
 
-    explicit CDB(const char* pszFile, const char* pszMode="r+");
+    /* Whether the DB may contain secrets (i. e., it is the wallet).  Then
+       keys and values are serialised into fresh, locked memory that is
+       cleared after use.  Other databases use the per-thread buffers
+       from GetDBBuffers.  */
+    bool fSecure;
+
+    explicit CDB(const char* pszFile, const char* pszMode="r+", bool fSecureIn=true);
     ~CDB() { Close(); }
 public:
     void Close();
@@ -66,14 +110,58 @@ private:
     void operator=(const CDB&);
 
 protected:
+    /* Prepare a pooled stream for use.  */
+    inline void ResetStream(CDataStream& ss) const
+    {
+        ss.clear();
+        ss.Init(SER_DISK, nVersion);
+    }
+
+    template<typename K, typename T>
+    bool ReadPooled(const K& key, T& value)
+    {
+        CDBBuffers& buf = GetDBBuffers();
+
+        // Key
+        ResetStream(buf.ssKey);
+        buf.ssKey << key;
+        Dbt datKey(&buf.ssKey[0], buf.ssKey.size());
+
+        // Read into the thread's buffer, growing it if necessary
+        if (buf.vchData.empty())
+            buf.vchData.resize(4096);
+        Dbt datValue;
+        datValue.set_flags(DB_DBT_USERMEM);
+        datValue.set_data(&buf.vchData[0]);
+        datValue.set_ulen(buf.vchData.size());
+        int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
+        if (ret == DB_BUFFER_SMALL)
+        {
+            buf.vchData.resize(datValue.get_size());
+            datValue.set_data(&buf.vchData[0]);
+            datValue.set_ulen(buf.vchData.size());
+            ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
+        }
+        if (ret != 0)
+            return false;
+
+        // Unserialize value
+        ResetStream(buf.ssValue);
+        buf.ssValue.write(&buf.vchData[0], datValue.get_size());
+        buf.ssValue >> value;
+        return true;
+    }
+
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
         if (!pdb)
             return false;
+        if (!fSecure)
+            return ReadPooled(key, value);
 
         // Key
-        CDataStream ssKey(SER_DISK, nVersion);
+        CSecureDataStream ssKey(SER_DISK, nVersion);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
@@ -87,7 +175,7 @@ protected:
             return false;
 
         // Unserialize value
-        CDataStream ssValue((char*)datValue.get_data(),
+        CSecureDataStream ssValue((char*)datValue.get_data(),
                             (char*)datValue.get_data() + datValue.get_size(),
                             SER_DISK, nVersion);
         ssValue >> value;
@@ -106,14 +194,26 @@ protected:
         if (fReadOnly)
             assert(("Write called on database in read-only mode", false));
 
+        if (!fSecure)
+        {
+            CDBBuffers& buf = GetDBBuffers();
+            ResetStream(buf.ssKey);
+            buf.ssKey << key;
+            ResetStream(buf.ssValue);
+            buf.ssValue << value;
+            Dbt datKey(&buf.ssKey[0], buf.ssKey.size());
+            Dbt datValue(&buf.ssValue[0], buf.ssValue.size());
+            return (pdb->put(GetTxn(), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE)) == 0);
+        }
+
         // Key
-        CDataStream ssKey(SER_DISK, nVersion);
+        CSecureDataStream ssKey(SER_DISK, nVersion);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
-        CDataStream ssValue(SER_DISK, nVersion);
+        CSecureDataStream ssValue(SER_DISK, nVersion);
         ssValue.reserve(10000);
         ssValue << value;
         Dbt datValue(&ssValue[0], ssValue.size());
@@ -135,8 +235,18 @@ protected:
         if (fReadOnly)
             assert(("Erase called on database in read-only mode", false));
 
+        if (!fSecure)
+        {
+            CDBBuffers& buf = GetDBBuffers();
+            ResetStream(buf.ssKey);
+            buf.ssKey << key;
+            Dbt datKey(&buf.ssKey[0], buf.ssKey.size());
+            const int ret = pdb->del(GetTxn(), &datKey, 0);
+            return (ret == 0 || ret == DB_NOTFOUND);
+        }
+
         // Key
-        CDataStream ssKey(SER_DISK, nVersion);
+        CSecureDataStream ssKey(SER_DISK, nVersion);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
@@ -155,8 +265,17 @@ protected:
         if (!pdb)
             return false;
 
+        if (!fSecure)
+        {
+            CDBBuffers& buf = GetDBBuffers();
+            ResetStream(buf.ssKey);
+            buf.ssKey << key;
+            Dbt datKey(&buf.ssKey[0], buf.ssKey.size());
+            return (pdb->exists(GetTxn(), &datKey, 0) == 0);
+        }
+
         // Key
-        CDataStream ssKey(SER_DISK, nVersion);
+        CSecureDataStream ssKey(SER_DISK, nVersion);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
@@ -180,7 +299,8 @@ protected:
         return pcursor;
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
+    template<typename Stream>
+    int ReadAtCursor(Dbc* pcursor, Stream& ssKey, Stream& ssValue, unsigned int fFlags=DB_NEXT)
     {
         // Read at cursor
         Dbt datKey;
@@ -212,8 +332,11 @@ protected:
         ssValue.write((char*)datValue.get_data(), datValue.get_size());
 
         // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
+        if (fSecure)
+        {
+            memset(datKey.get_data(), 0, datKey.get_size());
+            memset(datValue.get_data(), 0, datValue.get_size());
+        }
         free(datKey.get_data());
         free(datValue.get_data());
         return 0;
@@ -221,8 +344,9 @@ protected:
 
     /* Update the stream to our serialisation version.  This is useful
        for ReadAtCursor users.  */
+    template<typename Stream>
     inline void
-    SetStreamVersion (CDataStream& ss) const
+    SetStreamVersion (Stream& ss) const
     {
       ss.nVersion = nVersion;
     }
@@ -334,14 +458,23 @@ public:
 
 
 
+// Maximum number of entries in the cache of tx index entries and
+// transactions read through CTxDB (-txcachesize)
+extern int nTxCacheSize;
+void GetTxCacheStats(unsigned int& nEntries, uint64& nHits, uint64& nMisses);
+
 class CTxDB : public CDB
 {
 public:
-    CTxDB(const char* pszMode="r+") : CDB("blkindex.dat", pszMode) { }
+    CTxDB(const char* pszMode="r+") : CDB("blkindex.dat", pszMode, false) { }
 private:
     CTxDB(const CTxDB&);
     void operator=(const CTxDB&);
 
+    // Transactions whose index entry was changed in the open DB transaction
+    std::set<uint256> setTxnChanged;
+    void Invalidate(const uint256& hash);
+
     /* The txindex is immutable (only storing disk pos which doesn't change)
        during normal operation, but for updating the storage format
        we need this internally.  */
@@ -360,8 +493,15 @@ public:
     bool EraseBlockIndex(uint256 hash);
     bool ReadHashBestChain(uint256& hashBestChain);
     bool WriteHashBestChain(uint256 hashBestChain);
-    bool ReadBestInvalidWork(CBigNum& bnBestInvalidWork);
-    bool WriteBestInvalidWork(CBigNum bnBestInvalidWork);
+    bool ReadBlockIndexSnapshotId(uint256& hashId);
+    bool WriteBlockIndexSnapshotId(const uint256& hashId);
+    bool ReadBestInvalidWork(uint256& nBestInvalidWork);
+    bool WriteBestInvalidWork(const uint256& nBestInvalidWork);
+
+    // Like for CNameDB, finishing a DB transaction drops the changed
+    // entries from the cache again.
+    bool TxnCommit();
+    bool TxnAbort();
 
     /* Read/write number of "reserved" (but not yet used) bytes in the
        block files.  */
@@ -370,6 +510,11 @@ public:
 
     bool LoadBlockIndex();
 
+private:
+    bool LoadBlockIndexSnapshot();
+    bool LoadBlockIndexFromDB();
+
+public:
     /* Update txindex to new data format.  */
     bool RewriteTxIndex (int oldVersion);
 };
@@ -380,34 +525,114 @@ public:
 
 
 
+/**
+ * Key of the history records in the name index.  The height is stored
+ * big-endian, so that the records of a name are ordered by height in the
+ * database and can be walked with a cursor.
+ */
+class CNameHistoryKey
+{
+private:
+
+    unsigned char pchHeight[4];
+
+public:
+
+    vchType vchName;
+
+    inline CNameHistoryKey ()
+    {
+      SetHeight (0);
+    }
+
+    inline CNameHistoryKey (const vchType& name, unsigned nHeight)
+      : vchName(name)
+    {
+      SetHeight (nHeight);
+    }
+
+    inline void
+    SetHeight (unsigned nHeight)
+    {
+      pchHeight[0] = nHeight >> 24;
+      pchHeight[1] = nHeight >> 16;
+      pchHeight[2] = nHeight >> 8;
+      pchHeight[3] = nHeight;
+    }
+
+    inline unsigned
+    GetHeight () const
+    {
+      return (pchHeight[0] << 24) | (pchHeight[1] << 16)
+              | (pchHeight[2] << 8) | pchHeight[3];
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+      READWRITE (vchName);
+      READWRITE (FLATDATA (pchHeight));
+    )
+};
+
+/* Maximum number of names in the ReadName cache (-namecachesize).  */
+extern int nNameCacheSize;
+void GetNameCacheStats (unsigned& nEntries, uint64& nHits, uint64& nMisses);
+
 /**
  * Name index.  Non-inline implementation code is in namecoin.cpp, but the
  * class is declared here because it will be used for the "wrapper" database
  * set class below and in general makes sense here.
+ *
+ * For each name, the latest CNameIndex is stored under "namel".  The full
+ * history is kept in one record per (name, height) under "nameh", so that
+ * updating a name does not touch its older entries.
  */
 class CNameDB : public CDB
 {
 private:
 
-    inline bool
-    EraseName (const vchType& name)
+    static inline std::pair<std::string, vchType>
+    LatestKey (const vchType& name)
     {
-      return Erase (std::make_pair (std::string("namei"), name));
+      return std::make_pair (std::string ("namel"), name);
     }
 
-    inline bool
-    WriteName (const vchType& name, const std::vector<CNameIndex>& vtxPos)
+    static inline std::pair<std::string, CNameHistoryKey>
+    HistoryKey (const vchType& name, unsigned nHeight)
     {
-      if (vtxPos.empty ())
-        return EraseName (name);
-
-      return Write (std::make_pair (std::string("namei"), name), vtxPos);
+      return std::make_pair (std::string ("nameh"),
+                             CNameHistoryKey (name, nHeight));
     }
 
+    /* Find the heights of all history records of a name from nFrom on.
+       If vtxPos is not NULL, their entries are appended to it.  */
+    bool ScanHistory (const vchType& name, unsigned nFrom,
+                      std::vector<unsigned>& vHeights,
+                      std::vector<CNameIndex>* vtxPos);
+
+    /* Read the last history entry of a name before height nBefore.  */
+    bool ReadLastHistory (const vchType& name, unsigned nBefore,
+                          CNameIndex& nidx);
+
+    /* Remove a name with all its history.  */
+    bool EraseName (const vchType& name);
+
+    /* Get a cursor in the current DB transaction (if any).  PopEntry and
+       EraseName walk the history while connecting or disconnecting blocks,
+       and must see the changes made so far without blocking on them.  */
+    Dbc* GetTxnCursor ();
+
+    /* Names changed in the current DB transaction.  They are not put into
+       the name cache until the transaction is finished.  */
+    std::set<vchType> setTxnChanged;
+
+    /* Drop a name from the cache when its latest entry changes.  */
+    void Invalidate (const vchType& name);
+
 public:
 
     explicit inline CNameDB (const char* pszMode="r+")
-      : CDB("nameindexfull.dat", pszMode)
+      : CDB("nameindexfull.dat", pszMode, false)
     {}
 
     /* This is the main interface for reading the name index.  It returns
@@ -421,17 +646,17 @@ public:
     inline bool
     ReadNameVec (const vchType& name, std::vector<CNameIndex>& vtxPos)
     {
-      return Read (std::make_pair (std::string("namei"), name), vtxPos);
+      std::vector<unsigned> vHeights;
+      vtxPos.clear ();
+      return ScanHistory (name, 0, vHeights, &vtxPos) && !vtxPos.empty ();
     }
 
-    bool ExistsName(const vchType& name)
-    {
-        return Exists(make_pair(std::string("namei"), name));
-    }
+    /* This goes through ReadName, so that the entry is cached for the
+       lookup that usually follows.  */
+    bool ExistsName(const vchType& name);
 
-    /* Add a new CNameIndex entry for the given name.  This either creates
-       a completely new entry, or pushes the value onto the vector stored
-       in the database.  */
+    /* Add a new CNameIndex entry for the given name.  This appends it
+       to the history record at its height and updates the latest entry.  */
     bool PushEntry (const vchType& name, const CNameIndex& value);
 
     /* Remove CNameIndex entries (when rolling back the chain) up until
@@ -440,6 +665,16 @@ public:
        But we do not insist on that.  */
     bool PopEntry (const vchType& name, int nHeight);
 
+    /* Finishing a DB transaction drops the names changed in it from the
+       cache once more, so that no reader can have put in a stale entry
+       while the transaction was open.  */
+    bool TxnCommit ();
+    bool TxnAbort ();
+
+    /* Convert a name index in the old format (the full history of a name
+       as a single vector under "namei") to the current one.  */
+    bool Upgrade ();
+
     /* Read and write information about what heights have been pruned.  The
        value here is the earliest height which has not been removed.  It is -1
        if no pruning has been done so far.  */
@@ -461,10 +696,23 @@ public:
 
 
 
+/* Size of the write-back UTXO cache in bytes (-utxocachemb).  */
+extern int64 nUtxoCacheSize;
+
+struct CUtxoCacheEntry;
+class CUtxoCacheLayer;
+
+/* Write out the UTXO cache to the database.  */
+bool FlushUtxoCache ();
+
 class CUtxoDB : public CDB
 {
 public:
-    CUtxoDB(const char* pszMode="r+") : CDB("utxo.dat", pszMode) { }
+    /* If fCachedIn is set, changes go to the in-memory UTXO cache and are
+       written to the database only from time to time (see PrepareCommit).
+       This is used for the instance in DatabaseSet.  */
+    CUtxoDB(const char* pszMode="r+", bool fCachedIn=false);
+    ~CUtxoDB();
 
     /** Set of COutPoints as used in the DB verification.  */
     typedef std::set<COutPoint> OutPointSet;
@@ -473,6 +721,35 @@ private:
     CUtxoDB(const CUtxoDB&);
     void operator=(const CUtxoDB&);
 
+    bool fCached;
+
+    /* Changes done in the currently open DB transaction.  They are merged
+       into the shared cache only when the transaction is committed.  */
+    CUtxoCacheLayer* pTxnChanges;
+
+    /* Set when outputs of a transaction are removed (a block is disconnected)
+       in the current DB transaction.  The cache is written out together
+       with it, so that the UTXO set on disk is always for a block
+       in the main chain.  */
+    bool fTxnDisconnect;
+
+    /* Set by PrepareCommit if the cache is written out with the current
+       DB transaction.  */
+    bool fTxnFlushed;
+
+    /* Look up an entry in the cache layers.  Returns false if the database
+       itself has to be asked.  If pfTxnLayer is given, it is set to whether
+       the entry was found in the layer of the current DB transaction.  */
+    bool FindCached (const COutPoint& pos, CUtxoCacheEntry& entry,
+                     bool* pfTxnLayer = NULL);
+
+    /* Record a change in the cache (the transaction layer if there is an
+       open DB transaction, otherwise the shared cache).  */
+    void Change (const COutPoint& pos, const CUtxoCacheEntry& change);
+
+    /* Write the changes of a cache layer to the database.  */
+    bool WriteLayer (const CUtxoCacheLayer& layer);
+
     /** Type used as key into the DB.  */
     typedef std::pair<std::string, COutPoint> KeyType;
 
@@ -480,6 +757,13 @@ private:
        the key-string "txo" to it.  */
     KeyType GetKey (const COutPoint& pos);
 
+    /* Mark the database as written with the cache.  This is done when it
+       is created, and together with every update of the best block.  */
+    bool WriteBestBlock (const uint256& hash);
+
+    /* Remove all UTXO entries, before rebuilding the set.  */
+    bool ClearUtxos ();
+
     /* Internal routine that shares code for scanning all transactions
        in the blockchain.  It can be used (depending on the passed flags)
        to build the UTXO DB from it, or to verify it against the
@@ -504,6 +788,10 @@ public:
     /* Remove an entire transaction.  This is used to disconnect blocks.  */
     bool RemoveUtxo (const CTransaction& tx);
 
+    /* Mark a newly created database as written with the cache, so that
+       CatchUp rebuilds it unless it has been completed.  */
+    bool WriteCacheVersion ();
+
     /* Rescan the blockchain to build the UTXO set from scratch.  */
     bool Rescan ();
 
@@ -518,6 +806,22 @@ public:
 
     /* Return UTXO set.  */
     bool GetUtxoSet (OutPointSet& res);
+
+    /* Called before the DB transaction is committed.  If the cache should
+       be flushed, it is written out as part of the transaction together
+       with the best block hash from txdb.  */
+    bool PrepareCommit (CTxDB& txdb);
+    /* Called after the DB transaction has been committed (or failed to).
+       This updates the shared cache accordingly.  */
+    void FinishCommit (bool fOk);
+
+    bool TxnAbort ();
+
+    /* Bring the UTXO set on disk up to the best chain after a crash, when
+       the last changes have not been flushed.  This replays the missing
+       blocks, or rebuilds the set if it was never completed.  It is done
+       right after loading the block index.  */
+    bool CatchUp ();
 };
 
 
@@ -542,7 +846,7 @@ private:
 public:
 
   inline DatabaseSet (const char* pszMode = "r+")
-    : txDb(pszMode), utxoDb(pszMode), nameDb(pszMode)
+    : txDb(pszMode), utxoDb(pszMode, true), nameDb(pszMode)
   {}
 
   /* Expose the bundled databases.  */
@@ -593,15 +897,69 @@ public:
   inline bool
   TxnCommit ()
   {
+    if (!utxoDb.PrepareCommit (txDb))
+      {
+        TxnAbort ();
+        return error ("Failed to write out the UTXO cache!");
+      }
     if (!nameDb.TxnCommit ())
-      return error ("Failed to commit child transaction in NameDB!");
+      {
+        utxoDb.FinishCommit (false);
+        return error ("Failed to commit child transaction in NameDB!");
+      }
     if (!utxoDb.TxnCommit ())
-      return error ("Failed to commit child transaction in UTXO-DB!");
-    return txDb.TxnCommit ();
+      {
+        utxoDb.FinishCommit (false);
+        return error ("Failed to commit child transaction in UTXO-DB!");
+      }
+
+    const bool fOk = txDb.TxnCommit ();
+    utxoDb.FinishCommit (fOk);
+    return fOk;
+  }
+
+};
+
+/**
+ * Read-only DatabaseSet borrowed from a pool of open handles.  Opening the
+ * three databases takes cs_db and updates the use counts each time, which
+ * is wasted effort for the many short read-only lookups (RPC calls, game
+ * state, wallet).  The handles are given back to the pool when this object
+ * goes out of scope, and are closed again when the databases are flushed.
+ * Like a normal DatabaseSet, it must only be used by a single thread.
+ */
+class CReadDatabaseSet
+{
+
+private:
+
+  DatabaseSet* pset;
+
+  CReadDatabaseSet (const CReadDatabaseSet&);
+  void operator= (const CReadDatabaseSet&);
+
+public:
+
+  CReadDatabaseSet ();
+  ~CReadDatabaseSet ();
+
+  inline DatabaseSet&
+  operator* ()
+  {
+    return *pset;
+  }
+
+  inline DatabaseSet*
+  operator-> ()
+  {
+    return pset;
   }
 
 };
 
+/* Close all handles that are currently in the pool.  */
+void CloseReadDatabaseSets ();
+
 
 
 
@@ -610,7 +968,7 @@ public:
 class CAddrDB : public CDB
 {
 public:
-    CAddrDB(const char* pszMode="r+") : CDB("addr.dat", pszMode) { }
+    CAddrDB(const char* pszMode="r+") : CDB("addr.dat", pszMode, false) { }
 private:
     CAddrDB(const CAddrDB&);
     void operator=(const CAddrDB&);
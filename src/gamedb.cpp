@@ -4,6 +4,7 @@
 
 #include "headers.h"
 #include "huntercoin.h"
+#include "checkqueue.h"
 
 #include <boost/filesystem.hpp>
 
@@ -18,9 +19,9 @@ static const unsigned IN_MEMORY_STATE_CACHE = 10;
 class CGameDB : public CDB
 {
 public:
-    CGameDB(const char* pszMode="r+") : CDB("game.dat", pszMode) { }
+    CGameDB(const char* pszMode="r+") : CDB("game.dat", pszMode, false) { }
 
-    CGameDB(const char* pszMode, CDB& parent) : CDB("game.dat", pszMode)
+    CGameDB(const char* pszMode, CDB& parent) : CDB("game.dat", pszMode, false)
     {
       vTxn.push_back (parent.GetTxn ());
       ownTxn.push_back (false);
@@ -46,14 +47,68 @@ public:
     {
         return CDB::Erase(nHeight);
     }
+
+    /* Collect the heights of all stored states in ascending order.  Only
+       the keys are read, not the (large) states themselves.  */
+    bool
+    ReadHeights (std::vector<unsigned>& heights)
+    {
+      heights.clear ();
+
+      Dbc* pcursor = GetCursor ();
+      if (!pcursor)
+        return false;
+
+      loop
+        {
+          Dbt datKey;
+          datKey.set_flags (DB_DBT_MALLOC);
+          Dbt datValue;
+          datValue.set_flags (DB_DBT_PARTIAL);
+          datValue.set_doff (0);
+          datValue.set_dlen (0);
+
+          /* The scan can take a while, do not hold up shutdown.  */
+          if (fShutdown)
+            {
+              pcursor->close ();
+              return false;
+            }
+
+          const int ret = pcursor->get (&datKey, &datValue, DB_NEXT);
+          if (ret == DB_NOTFOUND)
+            break;
+          if (ret != 0)
+            {
+              pcursor->close ();
+              return false;
+            }
+
+          /* States are keyed by the height as a plain unsigned.  The only
+             other entry is the version, which has a longer key.  */
+          if (datKey.get_size () == sizeof (unsigned))
+            {
+              unsigned nHeight;
+              memcpy (&nHeight, datKey.get_data (), sizeof (nHeight));
+              heights.push_back (nHeight);
+            }
+          free (datKey.get_data ());
+        }
+      pcursor->close ();
+
+      /* The keys are not in numerical order in the btree.  */
+      std::sort (heights.begin (), heights.end ());
+      return true;
+    }
 };
 
 class GameStepValidator
 {
     bool fOwnState;
-    bool fOwnDb;
-    
+
     DatabaseSet* pdbset;
+    // Pooled handles borrowed if no database was given
+    CReadDatabaseSet* pownDbset;
 
     // Detect duplicates (multiple moves per block). Probably already handled by NameDB and not needed.
     std::set<PlayerID> dup;
@@ -67,12 +122,12 @@ protected:
 
 public:
     GameStepValidator(const GameState *pstate_)
-        : fOwnState(false), fOwnDb(false), pdbset(NULL), pstate(pstate_)
+        : fOwnState(false), pdbset(NULL), pownDbset(NULL), pstate(pstate_)
     {
     }
 
     GameStepValidator(DatabaseSet& dbset, CBlockIndex *pindex)
-        : fOwnState(true), fOwnDb(false), pdbset(&dbset)
+        : fOwnState(true), pdbset(&dbset), pownDbset(NULL)
     {
         GameState *newState = new GameState;
         if (!GetGameState (dbset, pindex, *newState))
@@ -87,20 +142,20 @@ public:
     {
       if (fOwnState)
         delete pstate;
-      if (pdbset && fOwnDb)
-        delete pdbset;
+      delete pownDbset;
     }
 
-    // Returns:
-    //   false - invalid move tx
-    //   true  - non-move tx or valid tx
-    bool IsValid(const CTransaction& tx, Move &outMove)
+protected:
+    // Extract player name and move from a name tx.  Returns false if the tx
+    // is invalid.  fMove is set to false for txs that are no moves.
+    bool DecodeMove(const CTransaction& tx, bool& fMove, int& op, int& nOut,
+                    std::string& sName, std::string& sValue)
     {
+        fMove = false;
         if (tx.nVersion != NAMECOIN_TX_VERSION)
           return true;
 
         std::vector<vchType> vvchArgs;
-        int op, nOut;
         if (!DecodeNameTx (tx, op, nOut, vvchArgs))
           return error ("GameStepValidator: could not decode a name tx");
 
@@ -130,13 +185,18 @@ public:
           return error ("GameStepValidator: invalid name tx found");
         }
 
-        const std::string sName = stringFromVch(vchName);
-        const std::string sValue = stringFromVch(vchValue);
-        if (dup.count(sName))
-            return error ("GameStepValidator: duplicate player name %s",
-                          sName.c_str ());
-        dup.insert(sName);
+        sName = stringFromVch(vchName);
+        sValue = stringFromVch(vchValue);
+        fMove = true;
+        return true;
+    }
 
+    // Check a decoded move against the game state (but not against other
+    // moves in the same block).
+    bool CheckMove(const CTransaction& tx, int op, int nOut,
+                   const std::string& sName, const std::string& sValue,
+                   Move &outMove, bool fCheckAddress = true)
+    {
         Move m;
         m.newLocked = tx.vout[nOut].nValue;
 
@@ -154,6 +214,18 @@ public:
         else if (op != OP_NAME_UPDATE)
           return error ("GameStepValidator: name_firstupdate is not spawn");
 
+        if (fCheckAddress && !CheckAddressLock(tx, m))
+            return false;
+
+        outMove = m;
+        return true;
+    }
+
+public:
+    // Check that an address operation of the move is signed by the
+    // player's address lock (if any).  This needs to read the inputs.
+    bool CheckAddressLock(const CTransaction& tx, const Move& m)
+    {
         std::string addressLock = m.AddressOperationPermission(*pstate);
         if (!addressLock.empty())
         {
@@ -162,8 +234,8 @@ public:
             bool found = false;
             if (!pdbset)
             {
-                pdbset = new DatabaseSet("r");
-                fOwnDb = true;
+                pownDbset = new CReadDatabaseSet();
+                pdbset = &**pownDbset;
             }
             for (int i = 0; i < tx.vin.size(); i++)
             {
@@ -186,9 +258,63 @@ public:
                 }
             }
             if (!found)
-                return error("GameStepValidator: address operation permission denied: move %s for player %s", sValue.c_str(), sName.c_str());
+                return error("GameStepValidator: address operation permission denied for player %s", m.player.c_str());
         }
-        outMove = m;
+        return true;
+    }
+
+protected:
+    // Use the given database for the checks that need one.
+    void SetDatabase(DatabaseSet* pdbsetIn)
+    {
+        delete pownDbset;
+        pownDbset = NULL;
+        pdbset = pdbsetIn;
+    }
+
+public:
+    // Returns:
+    //   false - invalid move tx
+    //   true  - non-move tx or valid tx
+    bool IsValid(const CTransaction& tx, Move &outMove)
+    {
+        bool fMove;
+        int op, nOut;
+        std::string sName, sValue;
+        if (!DecodeMove(tx, fMove, op, nOut, sName, sValue))
+            return false;
+        if (!fMove)
+            return true;
+
+        if (!CheckDuplicate(sName))
+            return false;
+
+        return CheckMove(tx, op, nOut, sName, sValue, outMove);
+    }
+
+    // Check a tx on its own, i.e. without looking for other moves of the
+    // same player.  fMove and sName tell whether it is a move and for whom.
+    // If fCheckAddress is false, CheckAddressLock must be done separately.
+    bool IsValidAlone(const CTransaction& tx, bool& fMove, std::string& sName,
+                      Move &outMove, bool fCheckAddress = true)
+    {
+        int op, nOut;
+        std::string sValue;
+        if (!DecodeMove(tx, fMove, op, nOut, sName, sValue))
+            return false;
+        if (!fMove)
+            return true;
+
+        return CheckMove(tx, op, nOut, sName, sValue, outMove, fCheckAddress);
+    }
+
+    // Check for another move of the same player, as IsValid does.
+    bool CheckDuplicate(const std::string& sName)
+    {
+        if (dup.count(sName))
+            return error ("GameStepValidator: duplicate player name %s",
+                          sName.c_str ());
+        dup.insert(sName);
         return true;
     }
 
@@ -215,29 +341,91 @@ static void InitStepData(StepData &stepData, const GameState &state)
     stepData.nTreasureAmount = nSubsidy * 9;
 }
 
+// Game-step session of the miner for one parent block.  It keeps the
+// parent game state, the result of validating each transaction against it
+// and the tax for the last set of included moves.  Assembling another block
+// template on the same parent thus only validates new transactions, and
+// only runs the game step if the included moves differ.
 class GameStepMinerImpl : public GameStepValidator
 {
-    StepData stepData;
+    struct CachedMove
+    {
+        bool fValid;
+        bool fMove;
+        std::string sName;
+        Move move;
+    };
+    std::map<uint256, CachedMove> mapMoves;
+
+    // State of the template being assembled
+    std::set<std::string> setNames;
+    std::vector<uint256> vIncluded;
+
+    // Tax for the moves of vTaxIncluded
+    bool fTaxCached;
+    std::vector<uint256> vTaxIncluded;
+    int64 nTax;
+
 public:
     GameStepMinerImpl (DatabaseSet& dbset, CBlockIndex *pindex)
-      : GameStepValidator (dbset, pindex)
+      : GameStepValidator (dbset, pindex), fTaxCached(false), nTax(0)
+    {
+      SetDatabase (NULL);
+    }
+
+    const uint256& GetParent() const
     {
-      InitStepData (stepData, *pstate);
+        return pstate->hashBlock;
+    }
+
+    void BeginTemplate(DatabaseSet& dbset)
+    {
+        SetDatabase(&dbset);
+        setNames.clear();
+        vIncluded.clear();
+    }
+
+    void EndTemplate()
+    {
+        SetDatabase(NULL);
     }
 
     bool AddTx(const CTransaction& tx)
     {
-        Move m;
-        if (!IsValid(tx, m))
+        const uint256 hash = tx.GetHash();
+        std::map<uint256, CachedMove>::iterator mi = mapMoves.find(hash);
+        if (mi == mapMoves.end())
+        {
+            CachedMove entry;
+            entry.fValid = IsValidAlone(tx, entry.fMove, entry.sName, entry.move);
+            mi = mapMoves.insert(std::make_pair(hash, entry)).first;
+        }
+
+        const CachedMove& entry = mi->second;
+        if (!entry.fValid)
             return false;
-        if (m)
-            stepData.vMoves.push_back(m);
+        if (entry.fMove)
+        {
+            if (setNames.count(entry.sName))
+                return error ("GameStepMiner: duplicate player name %s",
+                              entry.sName.c_str ());
+            setNames.insert(entry.sName);
+            vIncluded.push_back(hash);
+        }
 
         return true;
     }
 
     int64 ComputeTax()
     {
+        if (fTaxCached && vIncluded == vTaxIncluded)
+            return nTax;
+
+        StepData stepData;
+        InitStepData(stepData, *pstate);
+        BOOST_FOREACH(const uint256& hash, vIncluded)
+            stepData.vMoves.push_back(mapMoves[hash].move);
+
         StepResult stepResult;
         Game::GameState outState;
         if (!Game::PerformStep(*pstate, stepData, outState, stepResult))
@@ -246,19 +434,34 @@ public:
             return 0;
         }
 
-        return stepResult.nTaxAmount;
+        fTaxCached = true;
+        vTaxIncluded = vIncluded;
+        nTax = stepResult.nTaxAmount;
+        return nTax;
     }
 };
 
+// The session for the current parent block.  It is only used from
+// CreateNewBlock, which holds cs_main.
+static GameStepMinerImpl* pminerSession = NULL;
+
 // A simple wrapper (pImpl pattern) to remove dependency on the game-related headers when miner just wants to check transactions
 // (declared in hooks.h)
 GameStepMiner::GameStepMiner (DatabaseSet& dbset, CBlockIndex *pindex)
-  : pImpl(new GameStepMinerImpl(dbset, pindex))
-{}
+{
+    if (!pminerSession || pminerSession->GetParent() != pindex->GetBlockHash())
+    {
+        delete pminerSession;
+        pminerSession = NULL;
+        pminerSession = new GameStepMinerImpl(dbset, pindex);
+    }
+    pImpl = pminerSession;
+    pImpl->BeginTemplate(dbset);
+}
 
 GameStepMiner::~GameStepMiner()
 {
-    delete pImpl;
+    pImpl->EndTemplate();
 }
 
 bool GameStepMiner::AddTx(const CTransaction& tx)
@@ -271,6 +474,65 @@ int64 GameStepMiner::ComputeTax()
     return pImpl->ComputeTax();
 }
 
+/* Moves of a block are parsed and checked against the game state in
+   parallel, on the same number of threads as the script checks.  The
+   address locks (which need the database) and duplicate players are
+   checked afterwards, in block order.  */
+
+struct MoveCheckResult
+{
+    bool fMove;
+    std::string sName;
+    Move move;
+
+    MoveCheckResult() : fMove(false) {}
+};
+
+class CMoveCheck
+{
+    const GameState* pstate;
+    const CTransaction* ptx;
+    MoveCheckResult* presult;
+
+public:
+    CMoveCheck() : pstate(NULL), ptx(NULL), presult(NULL) {}
+    CMoveCheck(const GameState* pstateIn, const CTransaction* ptxIn, MoveCheckResult* presultIn)
+      : pstate(pstateIn), ptx(ptxIn), presult(presultIn) {}
+
+    bool operator()()
+    {
+        GameStepValidator validator(pstate);
+        return validator.IsValidAlone(*ptx, presult->fMove, presult->sName, presult->move, false);
+    }
+
+    void swap(CMoveCheck& check)
+    {
+        std::swap(pstate, check.pstate);
+        std::swap(ptx, check.ptx);
+        std::swap(presult, check.presult);
+    }
+};
+
+static CCheckQueue<CMoveCheck>* pmovecheckqueue = NULL;
+
+static void ThreadMoveCheck(void* parg)
+{
+    printf("ThreadMoveCheck started\n");
+    pmovecheckqueue->Thread();
+}
+
+void StartMoveCheckThreads()
+{
+    // As with the script checks, the calling thread takes part
+    if (nScriptCheckThreads <= 1)
+        return;
+
+    pmovecheckqueue = new CCheckQueue<CMoveCheck>(16);
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        if (!CreateThread(ThreadMoveCheck, NULL))
+            printf("Error: CreateThread(ThreadMoveCheck) failed\n");
+}
+
 bool
 PerformStep (CNameDB& nameDb, const GameState& inState, const CBlock* block,
              int64& nTax, GameState& outState,
@@ -283,16 +545,47 @@ PerformStep (CNameDB& nameDb, const GameState& inState, const CBlock* block,
     InitStepData(stepData, inState);
     stepData.newHash = block->GetHash();
 
+    // Parse and check the moves in parallel
+    std::vector<MoveCheckResult> vResults(block->vtx.size());
+    bool fAllOk;
+    CRITICAL_BLOCK(cs_main)
+    {
+        CCheckQueueControl<CMoveCheck> control(pmovecheckqueue);
+        std::vector<CMoveCheck> vChecks;
+        vChecks.reserve(block->vtx.size());
+        for (unsigned i = 0; i < block->vtx.size(); ++i)
+            vChecks.push_back(CMoveCheck(&inState, &block->vtx[i], &vResults[i]));
+        control.Add(vChecks);
+        fAllOk = control.Wait();
+    }
+
+    // Check for duplicates and address locks and create the moves
+    // in block order
     GameStepValidator gameStepValidator(&inState);
-    // Create moves for all move transactions
-    BOOST_FOREACH(const CTransaction& tx, block->vtx)
+    for (unsigned i = 0; i < block->vtx.size(); ++i)
     {
+        const CTransaction& tx = block->vtx[i];
+        const MoveCheckResult& res = vResults[i];
+
+        // If a check failed, the others may not have been run
         Move m;
-        if (!gameStepValidator.IsValid(tx, m))
-            return error("GameStepValidator rejected transaction %s in block %s", tx.GetHash().ToString().substr(0,10).c_str(), block->GetHash().ToString().c_str());
+        if (!fAllOk)
+        {
+            if (!gameStepValidator.IsValid(tx, m))
+                return error("GameStepValidator rejected transaction %s in block %s", tx.GetHash().ToString().substr(0,10).c_str(), block->GetHash().ToString().c_str());
+        }
+        else if (res.fMove)
+        {
+            if (!gameStepValidator.CheckDuplicate(res.sName)
+                || !gameStepValidator.CheckAddressLock(tx, res.move))
+                return error("GameStepValidator rejected transaction %s in block %s", tx.GetHash().ToString().substr(0,10).c_str(), block->GetHash().ToString().c_str());
+            m = res.move;
+        }
         if (m)
             stepData.vMoves.push_back(m);
     }
+    if (!fAllOk)
+        return error("PerformStep: move check failed for block %s", block->GetHash().ToString().c_str());
 
     StepResult stepResult;
     if (!Game::PerformStep(inState, stepData, outState, stepResult))
@@ -322,7 +615,7 @@ class GameStateCache
 private:
 
   /** Type used for the map blockhash -> state.  */
-  typedef std::map<uint256, GameState*> gameStateMap;
+  typedef uint256HashMap<GameState*>::type gameStateMap;
 
   /** Map holding the data.  */
   gameStateMap map;
@@ -416,9 +709,9 @@ GameStateCache::store (const GameState& state)
 
       /* See if there are entries for blocks not on the main chain.  Remove
          those first.  */
-      for (i = map.begin (); i != map.end () && !deleted; ++i)
+      for (i = map.begin (); i != map.end (); ++i)
         {
-          std::map<uint256, CBlockIndex*>::const_iterator j;
+          BlockMap::const_iterator j;
           j = mapBlockIndex.find (i->second->hashBlock);
 
           if (j == mapBlockIndex.end () || !j->second->IsInMainChain ())
@@ -433,6 +726,7 @@ GameStateCache::store (const GameState& state)
               delete i->second;
               map.erase (i);
               deleted = true;
+              break;
             }
         }
       
@@ -475,7 +769,8 @@ const GameState& GetCurrentGameState()
 
     /* Else, calulate the state.  */
     GameState cur;
-    DatabaseSet dbset("r");
+    CReadDatabaseSet readDbset;
+    DatabaseSet& dbset = *readDbset;
     GetGameState (dbset, pindexBest, cur);
 
     /* If it is still not in the cache, store it explicitly.  */
@@ -630,30 +925,176 @@ void RollbackGameState(CTxDB& txdb, CBlockIndex* pindex)
     CGameDB("r+", txdb).Erase(pindex->nHeight);
 }
 
-extern CWallet* pwalletMain;
+/* ************************************************************************** */
+/* Pending moves.  */
 
-// Erase unconfirmed transactions, that should not be re-broadcasted, because they're not
-// valid for the current game state (e.g. attack on some player who's already killed)
-void EraseBadMoveTransactions()
+/* Index of the move transactions in the memory pool by player name.  For each
+   we keep the parsed move and the hash of the game state it was last checked
+   against.  All entries are known to be valid for the state hashPendingState.
+   When the best chain advances, only moves of players that were changed
+   by the game step need to be checked again.  Caller must hold cs_main.  */
+
+struct PendingMove
 {
-    /* If we do not have a wallet yet, nothing to do.  This can happen
-       with a completely fresh initialisation.  */
-    if (!pwalletMain)
-        return;
+  Move move;
+  uint256 hashState;
+};
 
-    CRITICAL_BLOCK(cs_main)
+typedef std::map<uint256, PendingMove> PendingMovesOfPlayer;
+static std::map<PlayerID, PendingMovesOfPlayer> mapPendingMoves;
+static uint256 hashPendingState = 0;
+
+bool
+AddPendingMove (const CTransaction& tx)
+{
+  const GameState& state = GetCurrentGameState ();
+  GameStepValidator validator(&state);
+
+  bool fMove;
+  std::string sName;
+  PendingMove entry;
+  if (!validator.IsValidAlone (tx, fMove, sName, entry.move))
+    return false;
+  if (!fMove)
+    return true;
+
+  entry.hashState = state.hashBlock;
+  mapPendingMoves[sName][tx.GetHash ()] = entry;
+
+  return true;
+}
+
+void
+RemovePendingMove (const CTransaction& tx)
+{
+  std::vector<vchType> vvchArgs;
+  int op, nOut;
+  if (tx.nVersion != NAMECOIN_TX_VERSION
+      || !DecodeNameTx (tx, op, nOut, vvchArgs) || op == OP_NAME_NEW)
+    return;
+
+  std::map<PlayerID, PendingMovesOfPlayer>::iterator mi;
+  mi = mapPendingMoves.find (stringFromVch (vvchArgs[0]));
+  if (mi == mapPendingMoves.end ())
+    return;
+
+  mi->second.erase (tx.GetHash ());
+  if (mi->second.empty ())
+    mapPendingMoves.erase (mi);
+}
+
+/* Check whether the moves of a player may be affected by the change from
+   one state to the other.  These are the fields Move::IsValid looks at.  */
+static bool
+PlayerChanged (const PlayerState& a, const PlayerState& b)
+{
+  return a.lockedCoins != b.lockedCoins || a.addressLock != b.addressLock;
+}
+
+/* Find the players changed between the state pending moves were checked
+   against and the given one.  Returns false if this is not possible (e.g.,
+   after multiple blocks or a reorg), and all moves need to be checked.  */
+static bool
+GetChangedPlayers (const GameState& state, PlayerSet& changed)
+{
+  if (state.hashBlock == hashPendingState)
+    return true;
+  if (!pindexBest->pprev || *pindexBest->pprev->phashBlock != hashPendingState)
+    return false;
+  const GameState* pold = stateCache.query (hashPendingState);
+  if (!pold)
+    return false;
+
+  /* The fee rules change with forks.  */
+  for (int f = FORK_POISON; f <= FORK_TIMESAVE; ++f)
+    if (ForkInEffect (static_cast<Fork> (f), pold->nHeight + 1)
+          != ForkInEffect (static_cast<Fork> (f), state.nHeight + 1))
+      return false;
+
+  /* Both maps are sorted by name, so walk them in parallel.  */
+  PlayerStateMap::const_iterator i = pold->players.begin ();
+  PlayerStateMap::const_iterator j = state.players.begin ();
+  while (i != pold->players.end () || j != state.players.end ())
+    {
+      if (j == state.players.end ()
+          || (i != pold->players.end () && i->first < j->first))
+        changed.insert ((i++)->first);
+      else if (i == pold->players.end () || j->first < i->first)
+        changed.insert ((j++)->first);
+      else
+        {
+          if (PlayerChanged (i->second, j->second))
+            changed.insert (i->first);
+          ++i;
+          ++j;
+        }
+    }
+
+  return true;
+}
+
+/* Check again the pending moves of the given player against the state.  Txs
+   that are no longer valid are added to setInvalid.  */
+static void
+CheckPendingMoves (DatabaseSet& dbset, const GameState& state,
+                   PendingMovesOfPlayer& moves, std::set<uint256>& setInvalid)
+{
+  GameStepValidator validator(&state);
+  for (PendingMovesOfPlayer::iterator mi = moves.begin ();
+       mi != moves.end (); ++mi)
+    {
+      if (mi->second.hashState == state.hashBlock)
+        continue;
+
+      TxMap::const_iterator ti = mapTransactions.find (mi->first);
+      if (ti == mapTransactions.end ())
+        continue;
+      const CTransaction& tx = ti->second;
+
+      bool fMove;
+      std::string sName;
+      vchType vchName;
+      if (IsConflictedTx (dbset, tx, vchName)
+          || !validator.IsValidAlone (tx, fMove, sName, mi->second.move))
+        setInvalid.insert (mi->first);
+      else
+        mi->second.hashState = state.hashBlock;
+    }
+}
+
+extern CWallet* pwalletMain;
+
+// Erase unconfirmed wallet transactions that are bad moves.  Those in the
+// memory pool have already been checked and are given in setInvalid.
+static void EraseBadWalletMoves(const GameState& state, const std::set<uint256>& setInvalid)
+{
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
     {
         std::map<uint256, CWalletTx> mapRemove;
         std::vector<unsigned char> vchName;
 
-        GameStepValidator gameStepValidator(&GetCurrentGameState ());
+        GameStepValidator gameStepValidator(&state);
 
         {
-            DatabaseSet dbset("r");
+            CReadDatabaseSet readDbset;
+            DatabaseSet& dbset = *readDbset;
             BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, pwalletMain->mapWallet)
             {
                 CWalletTx& wtx = item.second;
+                if (wtx.nVersion != NAMECOIN_TX_VERSION)
+                    continue;
+
+                if (setInvalid.count(item.first))
+                {
+                    mapRemove[item.first] = wtx;
+                    continue;
+                }
+
+                bool fInPool;
+                CRITICAL_BLOCK(cs_mapTransactions)
+                    fInPool = (mapTransactions.count(item.first) > 0);
+                if (fInPool)
+                    continue;
 
                 if (wtx.GetDepthInMainChain () < 1
                     && (IsConflictedTx (dbset, wtx, vchName)
@@ -711,33 +1152,186 @@ void EraseBadMoveTransactions()
     }
 }
 
-void
-PruneGameDB (unsigned nHeight)
+// Erase unconfirmed transactions, that should not be re-broadcasted, because they're not
+// valid for the current game state (e.g. attack on some player who's already killed)
+// Moves in the memory pool are found through the pending move index and removed
+// from the pool even if they are not ours.
+void EraseBadMoveTransactions()
 {
-  CGameDB gameDb("r+");
+    CRITICAL_BLOCK(cs_main)
+    {
+        const GameState& state = GetCurrentGameState ();
 
-  std::set<unsigned> toRemove;
-  unsigned cnt = 0;
-  unsigned last = 0;
-  for (unsigned i = 0; i < nHeight; ++i)
-    if (gameDb.Exists (i))
+        std::set<uint256> setInvalid;
+        std::vector<CTransaction> vInvalid;
+        CRITICAL_BLOCK(cs_mapTransactions)
+        {
+            CReadDatabaseSet readDbset;
+            DatabaseSet& dbset = *readDbset;
+
+            PlayerSet changed;
+            std::map<PlayerID, PendingMovesOfPlayer>::iterator mi;
+            if (GetChangedPlayers (state, changed))
+            {
+                BOOST_FOREACH(const PlayerID& name, changed)
+                {
+                    mi = mapPendingMoves.find (name);
+                    if (mi != mapPendingMoves.end ())
+                        CheckPendingMoves (dbset, state, mi->second, setInvalid);
+                }
+            }
+            else
+            {
+                for (mi = mapPendingMoves.begin (); mi != mapPendingMoves.end (); ++mi)
+                    CheckPendingMoves (dbset, state, mi->second, setInvalid);
+            }
+            hashPendingState = state.hashBlock;
+
+            BOOST_FOREACH(const uint256& hash, setInvalid)
+                vInvalid.push_back (mapTransactions[hash]);
+        }
+
+        if (!vInvalid.empty ())
+            printf ("EraseBadMoveTransactions : removing %u moves from the memory pool\n",
+                    static_cast<unsigned> (vInvalid.size ()));
+        BOOST_FOREACH(CTransaction& tx, vInvalid)
+            tx.RemoveFromMemoryPool ();
+
+        /* If we do not have a wallet yet, there is nothing more to do.  This
+           can happen with a completely fresh initialisation.  */
+        if (pwalletMain)
+            EraseBadWalletMoves (state, setInvalid);
+    }
+}
+
+/* Number of states erased at once by PruneGameDB.  Each erase is its own
+   (auto-committed) DB transaction.  A batch is done while holding cs_main,
+   so that it can not deadlock with block processing in the database, and
+   the lock is released between batches so that block processing is never
+   held up for long.  */
+static const unsigned PRUNE_GAMEDB_BATCH = 100;
+
+/* Minimum value for -prunegamedepth.  Reorgs deeper than the pruning depth
+   have to replay the game state from the last state kept before them.  */
+static const int MIN_PRUNE_GAME_DEPTH = 2000;
+
+int nPruneGameDepth = 0;
+
+unsigned
+PruneGameDB (unsigned nHeight, bool fRewrite)
+{
+  std::vector<unsigned> heights;
+  {
+    CGameDB gameDb("r");
+    if (!gameDb.ReadHeights (heights))
       {
-        ++cnt;
-        toRemove.insert (i);
-        last = i;
+        if (!fShutdown)
+          error ("PruneGameDB: reading the stored heights failed");
+        return 0;
       }
-  if (cnt > 0)
+  }
+
+  /* Keep the newest state before the threshold.  */
+  std::vector<unsigned> toRemove;
+  BOOST_FOREACH(unsigned h, heights)
+    if (h < nHeight)
+      toRemove.push_back (h);
+  if (toRemove.empty ())
+    return 0;
+  const unsigned last = toRemove.back ();
+  toRemove.pop_back ();
+
+  if (!toRemove.empty ())
+    printf ("Pruning %u game states before %u from the GameDB...\n",
+            static_cast<unsigned> (toRemove.size ()), last);
+
+  unsigned cnt = 0;
+  unsigned i = 0;
+  while (i < toRemove.size () && !fShutdown)
+    {
+      const unsigned end = std::min<unsigned> (toRemove.size (),
+                                               i + PRUNE_GAMEDB_BATCH);
+
+      /* If a block is being processed, retry the batch later.  A state
+         may have been removed meanwhile by AdvanceGameState, which
+         is fine.  */
+      bool fDone = false;
+      TRY_CRITICAL_BLOCK (cs_main)
+        {
+          CGameDB gameDb("r+");
+          for (unsigned j = i; j < end; ++j)
+            if (gameDb.Erase (toRemove[j]))
+              ++cnt;
+          fDone = true;
+        }
+
+      if (fDone)
+        i = end;
+      else
+        MilliSleep (100);
+    }
+
+  if (fRewrite)
+    CDB::Rewrite ("game.dat");
+
+  return cnt;
+}
+
+static void
+ThreadPruneGameDB2 (void* parg)
+{
+  if (nPruneGameDepth < MIN_PRUNE_GAME_DEPTH)
     {
-      toRemove.erase (last);
-      --cnt;
+      printf ("-prunegamedepth=%d is too small, using %d\n",
+              nPruneGameDepth, MIN_PRUNE_GAME_DEPTH);
+      nPruneGameDepth = MIN_PRUNE_GAME_DEPTH;
     }
 
-  printf ("Pruning %d game states before %d from the GameDB...\n", cnt, last);
+  printf ("ThreadPruneGameDB started, keeping %d blocks\n", nPruneGameDepth);
+
+  /* States are only kept every KEEP_EVERY_NTH_STATE blocks, so there is
+     nothing new to prune until the threshold has moved that far.  */
+  int nLastPruned = -1;
+  while (!fShutdown)
+    {
+      MilliSleep (1000);
+
+      const int nPruneHeight = nBestHeight - nPruneGameDepth;
+      if (nPruneHeight <= 0 || (nLastPruned >= 0
+                                && nPruneHeight - nLastPruned
+                                    < KEEP_EVERY_NTH_STATE))
+        continue;
 
-  BOOST_FOREACH(unsigned i, toRemove)
-    gameDb.Erase (i);
+      const unsigned cnt = PruneGameDB (nPruneHeight, false);
+      if (cnt > 0)
+        printf ("ThreadPruneGameDB: removed %u states before %d\n",
+                cnt, nPruneHeight);
+      nLastPruned = nPruneHeight;
+    }
+}
 
-  gameDb.Rewrite ();
+/* The thread is counted in vnThreadsRunning[6], so that StopNode waits for
+   it before the database environment is closed.  */
+void
+ThreadPruneGameDB (void* parg)
+{
+  try
+    {
+      vnThreadsRunning[6]++;
+      ThreadPruneGameDB2 (parg);
+      vnThreadsRunning[6]--;
+    }
+  catch (std::exception& e)
+    {
+      vnThreadsRunning[6]--;
+      PrintException (&e, "ThreadPruneGameDB()");
+    }
+  catch (...)
+    {
+      vnThreadsRunning[6]--;
+      PrintException (NULL, "ThreadPruneGameDB()");
+    }
+  printf ("ThreadPruneGameDB exiting\n");
 }
 
 bool UpgradeGameDB()
@@ -23,6 +23,10 @@ class CScript;
 /* Check a move tx for validity at the given game state.  */
 bool IsMoveValid (const Game::GameState& state, const CTransaction& tx);
 
+/* Start the worker threads for checking the moves of a block in parallel.
+   Their number is nScriptCheckThreads.  */
+void StartMoveCheckThreads();
+
 bool PerformStep (CNameDB& pnameDb, const Game::GameState& inState,
                   const CBlock* block, int64& nTax, Game::GameState& outState,
                   std::vector<CTransaction>* outvgametx = NULL);
@@ -35,6 +39,12 @@ bool AdvanceGameState (DatabaseSet& dbset, CBlockIndex* pindex,
 void RollbackGameState(CTxDB& txdb, CBlockIndex* pindex);
 const Game::GameState &GetCurrentGameState();
 
+/* Keep track of move txs in the memory pool, indexed by player name.
+   AddPendingMove checks the tx against the current game state and
+   returns false if it is invalid.  */
+bool AddPendingMove (const CTransaction& tx);
+void RemovePendingMove (const CTransaction& tx);
+
 // Like name_clean; called in ResendWalletTransactions to remove outdated move transactions that are
 // no longer valid for the current game state
 void EraseBadMoveTransactions();
@@ -43,8 +53,18 @@ void EraseBadMoveTransactions();
    number of blocks.  Actually, we keep the newest state that is older
    than the treshold, so that we can integrate forward
    in time from there and (more or less) efficiently reconstruct
-   every state after the treshold.  */
-void PruneGameDB (unsigned nHeight);
+   every state after the treshold.  Only the keys are scanned, and the
+   states are erased in small batches.  If fRewrite is set, the file is
+   compacted afterwards, which blocks until nobody else uses it.  Returns
+   the number of states removed.  */
+unsigned PruneGameDB (unsigned nHeight, bool fRewrite = true);
+
+/* Prune the game db automatically in the background, keeping states for
+   the last nPruneGameDepth blocks (-prunegamedepth).  A reorg deeper than
+   that has to replay the game from the last state kept before it, so the
+   depth is raised to at least 2000 blocks.  */
+extern int nPruneGameDepth;
+void ThreadPruneGameDB (void* parg);
 
 bool UpgradeGameDB();
 
@@ -131,6 +131,7 @@ CreateGameTransactions (CNameDB& nameDb, const GameState& gameState,
   if (!txNew.IsNull ())
     {
       outvgametx.push_back (txNew);
+      outvgametx.back ().Freeze ();
       if (fDebug)
         printf ("Game tx for killed players: %s\n", txNew.GetHashForLog ());
     }
@@ -189,6 +190,7 @@ CreateGameTransactions (CNameDB& nameDb, const GameState& gameState,
   if (!txNew.IsNull ())
     {
       outvgametx.push_back (txNew);
+      outvgametx.back ().Freeze ();
       if (fDebug)
         printf ("Game tx for bounties: %s\n", txNew.GetHashForLog ());
     }
@@ -0,0 +1,70 @@
+#ifndef HUNTERCOIN_HASHMAP_H
+#define HUNTERCOIN_HASHMAP_H
+
+#include "uint256.h"
+
+#include <openssl/rand.h>
+
+#ifndef Q_MOC_RUN
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#endif
+
+/* Hashed containers for things keyed by uint256 (block and tx hashes).
+   std::map does a full 32-byte comparison at every level of the tree,
+   while a hash table needs only a single hash computation and (usually)
+   one comparison per lookup.
+
+   The keys are cryptographic hashes themselves, so their bits are
+   already uniformly distributed and we can simply use them.  However,
+   txids can be ground cheaply, so that an attacker could make many of
+   them fall into the same bucket.  To prevent this, each hasher mixes
+   two words of the key with a random salt chosen when it is
+   constructed (i.e., once per container).
+
+   Use these only where the iteration order doesn't matter.  Code that
+   relies on ordered iteration (for consensus or output) must keep
+   using std::map.  */
+
+class SaltedUint256Hasher
+{
+private:
+
+  uint64 k0, k1;
+
+public:
+
+  SaltedUint256Hasher ()
+    : k0(0), k1(0)
+  {
+    /* If this fails, we still work -- just without the salt.  */
+    RAND_bytes (reinterpret_cast<unsigned char*> (&k0), sizeof (k0));
+    RAND_bytes (reinterpret_cast<unsigned char*> (&k1), sizeof (k1));
+  }
+
+  inline size_t
+  operator() (const uint256& hash) const
+  {
+    uint64 h = (hash.Get64 (0) ^ k0) * 0x9E3779B97F4A7C15ULL;
+    h ^= (hash.Get64 (1) ^ k1);
+    h *= 0xC2B2AE3D27D4EB4FULL;
+    return static_cast<size_t> (h ^ (h >> 32));
+  }
+
+};
+
+/* Convenience wrappers for the container types.  Since C++98 has no
+   template aliases, they are used as uint256HashMap<V>::type.  */
+
+template<typename V>
+  struct uint256HashMap
+{
+  typedef boost::unordered_map<uint256, V, SaltedUint256Hasher> type;
+};
+
+struct uint256HashSet
+{
+  typedef boost::unordered_set<uint256, SaltedUint256Hasher> type;
+};
+
+#endif // HUNTERCOIN_HASHMAP_H
@@ -31,6 +31,9 @@ public:
     virtual bool GenesisBlock(CBlock& block) = 0;
     virtual bool Lockin(int nHeight, uint256 hash) = 0;
     virtual int LockinHeight() = 0;
+    /* Hash of a block whose ancestors' signatures need not be verified
+       (can be overridden with -assumevalid).  Zero for none.  */
+    virtual uint256 AssumeValid() = 0;
     virtual std::string IrcPrefix() = 0;
     virtual void MessageStart(char* pchMessageStart) = 0;
     virtual bool AcceptToMemoryPool(DatabaseSet& dbset,
@@ -56,6 +59,7 @@ public:
 };
 
 // A simple wrapper (pImpl pattern) to remove dependency on the game-related headers when miner just wants to check transactions
+// Validated moves and the tax are kept between instances for the same parent block
 class GameStepMiner
 {
     class GameStepMinerImpl *pImpl;
@@ -92,6 +92,7 @@ public:
     virtual bool GenesisBlock(CBlock& block);
     virtual bool Lockin(int nHeight, uint256 hash);
     virtual int LockinHeight();
+    virtual uint256 AssumeValid();
     virtual string IrcPrefix();
     virtual bool AcceptToMemoryPool (DatabaseSet& dbset,
                                      const CTransaction& tx);
@@ -246,7 +247,7 @@ int GetTxPosHeight(const CDiskTxPos& txPos)
     if (!block.ReadFromDisk(txPos.nBlockFile, txPos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     const CBlockIndex* pindex = (*mi).second;
@@ -317,7 +318,8 @@ CreateTransactionWithInputTx (const vector<pair<CScript, int64> >& vecSend,
     CRITICAL_BLOCK(cs_main)
     {
         // txdb must be opened before the mapWallet lock
-        CTxDB txdb("r");
+        CReadDatabaseSet readDbset;
+        CTxDB& txdb = readDbset->tx ();
         CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
         {
             nFeeRet = nTransactionFee;
@@ -553,7 +555,8 @@ Value sendtoname(const Array& params, bool fHelp)
             + HelpRequiringPassphrase());
 
     vector<unsigned char> vchName = vchFromValue(params[0]);
-    CNameDB dbName("r");
+    CReadDatabaseSet readDbset;
+    CNameDB& dbName = readDbset->name ();
     if (!dbName.ExistsName(vchName))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Name not found");
 
@@ -612,7 +615,8 @@ Value name_list(const Array& params, bool fHelp)
     CRITICAL_BLOCK(cs_main)
     CRITICAL_BLOCK(pwalletMain->cs_mapWallet)
       {
-        CTxDB txdb("r");
+        CReadDatabaseSet readDbset;
+        CTxDB& txdb = readDbset->tx ();
 
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item,
                       pwalletMain->mapWallet)
@@ -731,7 +735,8 @@ Value name_debug1(const Array& params, bool fHelp)
     {
         //vector<CDiskTxPos> vtxPos;
         vector<CNameIndex> vtxPos;
-        CNameDB dbName("r");
+        CReadDatabaseSet readDbset;
+        CNameDB& dbName = readDbset->name ();
         if (!dbName.ReadNameVec (vchName, vtxPos))
         {
             error("failed to read from name DB");
@@ -767,7 +772,8 @@ Value name_show(const Array& params, bool fHelp)
     CRITICAL_BLOCK(cs_main)
     {
         CNameIndex nidx;
-        CNameDB dbName("r");
+        CReadDatabaseSet readDbset;
+        CNameDB& dbName = readDbset->name ();
         if (!dbName.ReadName (vchName, nidx))
             throw JSONRPCError(RPC_WALLET_ERROR, "failed to read from name DB");
 
@@ -813,7 +819,8 @@ Value name_history(const Array& params, bool fHelp)
     CRITICAL_BLOCK(cs_main)
     {
         vector<CNameIndex> vtxPos;
-        CNameDB dbName("r");
+        CReadDatabaseSet readDbset;
+        CNameDB& dbName = readDbset->name ();
         if (!dbName.ReadNameVec (vchName, vtxPos))
             throw JSONRPCError(RPC_WALLET_ERROR, "failed to read from name DB");
 
@@ -886,7 +893,8 @@ Value name_filter(const Array& params, bool fHelp)
         fStat = (params[4].get_str() == "stat" ? true : false);
 
 
-    CNameDB dbName("r");
+    CReadDatabaseSet readDbset;
+    CNameDB& dbName = readDbset->name ();
     Array oRes;
 
     vector<unsigned char> vchName;
@@ -970,7 +978,8 @@ Value name_scan(const Array& params, bool fHelp)
         nMax = (int)vMax.get_real();
     }
 
-    CNameDB dbName("r");
+    CReadDatabaseSet readDbset;
+    CNameDB& dbName = readDbset->name ();
     Array oRes;
 
     //vector<pair<vector<unsigned char>, CDiskTxPos> > nameScan;
@@ -1056,7 +1065,8 @@ Value name_firstupdate(const Array& params, bool fHelp)
     }
 
     {
-        CNameDB dbName("r");
+        CReadDatabaseSet readDbset;
+        CNameDB& dbName = readDbset->name ();
         CTransaction tx;
         if (GetTxOfName(dbName, vchName, tx) && !tx.IsGameTx())
         {
@@ -1181,7 +1191,8 @@ Value name_update(const Array& params, bool fHelp)
 
         CTransaction tx;
         {
-          CNameDB dbName("r");
+          CReadDatabaseSet readDbset;
+          CNameDB& dbName = readDbset->name ();
           if (!GetTxOfName(dbName, vchName, tx))
             throw runtime_error("could not find a coin with this name");
         }
@@ -1324,7 +1335,8 @@ name_register (const Array& params, bool fHelp)
           throw runtime_error ("there are pending operations on that name");
         }
 
-      CNameDB dbName("r");
+      CReadDatabaseSet readDbset;
+      CNameDB& dbName = readDbset->name ();
       CTransaction tx;
       if (GetTxOfName (dbName, vchName, tx) && !tx.IsGameTx ())
         {
@@ -1416,7 +1428,8 @@ AddRawTxNameOperation (CTransaction& tx, const Object& obj)
   int64 nCoinAmount = -1;
   CRITICAL_BLOCK(cs_main)
   {
-    CNameDB dbName("r");
+    CReadDatabaseSet readDbset;
+    CNameDB& dbName = readDbset->name ();
     CTransaction prevTx;
     if (!GetTxOfName (dbName, vchName, prevTx))
       throw std::runtime_error ("could not find a coin with this name");
@@ -1568,7 +1581,8 @@ Value game_getstate(const Array& params, bool fHelp)
                 throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot find block at specified height");
         }
 
-        DatabaseSet dbset("r");
+        CReadDatabaseSet readDbset;
+        DatabaseSet& dbset = *readDbset;
         if (!GetGameState (dbset, pindex, state))
             throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot compute game state at specified height");
     }
@@ -1654,7 +1668,8 @@ Value game_getplayerstate(const Array& params, bool fHelp)
                 throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot find block at specified height");
         }
 
-        DatabaseSet dbset("r");
+        CReadDatabaseSet readDbset;
+        DatabaseSet& dbset = *readDbset;
         if (!GetGameState (dbset, pindex, state))
             throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot compute game state at specified height");
     }
@@ -1834,7 +1849,7 @@ bool CNameDB::ScanNames(
         vector<pair<vector<unsigned char>, CNameIndex> >& nameScan)
         //vector<pair<vector<unsigned char>, CDiskTxPos> >& nameScan)
 {
-    Dbc* pcursor = GetCursor();
+    Dbc* pcursor = GetTxnCursor();
     if (!pcursor)
         return false;
 
@@ -1844,7 +1859,7 @@ bool CNameDB::ScanNames(
         // Read next record
         CDataStream ssKey;
         if (fFlags == DB_SET_RANGE)
-            ssKey << make_pair(string("namei"), vchName);
+            ssKey << make_pair(string("namel"), vchName);
         CDataStream ssValue;
         int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
         fFlags = DB_NEXT;
@@ -1856,22 +1871,14 @@ bool CNameDB::ScanNames(
         // Unserialize
         string strType;
         ssKey >> strType;
-        if (strType == "namei")
-        {
-            vector<unsigned char> vchName;
-            ssKey >> vchName;
-            string strName = stringFromVch(vchName);
-            //vector<CDiskTxPos> vtxPos;
-            vector<CNameIndex> vtxPos;
-            ssValue >> vtxPos;
-            //CDiskTxPos txPos;
-            CNameIndex txPos;
-            if (!vtxPos.empty())
-            {
-                txPos = vtxPos.back();
-            }
-            nameScan.push_back(make_pair(vchName, txPos));
-        }
+        if (strType != "namel")
+            break;
+
+        vector<unsigned char> vchName;
+        ssKey >> vchName;
+        CNameIndex txPos;
+        ssValue >> txPos;
+        nameScan.push_back(make_pair(vchName, txPos));
 
         if (nameScan.size() >= nMax)
             break;
@@ -1890,7 +1897,8 @@ analyseutxo (const Array& params, bool fHelp)
           "Look through the UTXO and construct certain data about it.");
 
   CCriticalBlock lock(cs_main);
-  DatabaseSet dbset("r");
+  CReadDatabaseSet readDbset;
+  DatabaseSet& dbset = *readDbset;
 
   /* Read UTXO database.  */
   unsigned txoCnt;
@@ -2258,17 +2266,19 @@ CHuntercoinHooks::AcceptToMemoryPool (DatabaseSet& dbset,
     return error("%s: no output in name tx %s",
                  __func__, tx.ToString().c_str());
 
-  if (!IsMoveValid (GetCurrentGameState(), tx))
-    return error("%s: invalid game move", __func__);
-
   int op, nOut;
   std::vector<vchType> vvch;
   if (!DecodeNameTx (tx, op, nOut, vvch))
     return error("%s: could not decode name tx", __func__);
 
-  if (op != OP_NAME_NEW)
-    CRITICAL_BLOCK(cs_main)
-      mapNamePending[vvch[0]].insert(tx.GetHash());
+  CRITICAL_BLOCK(cs_main)
+    {
+      if (!AddPendingMove (tx))
+        return error("%s: invalid game move", __func__);
+
+      if (op != OP_NAME_NEW)
+        mapNamePending[vvch[0]].insert(tx.GetHash());
+    }
 
   return true;
 }
@@ -2296,6 +2306,7 @@ void CHuntercoinHooks::RemoveFromMemoryPool(const CTransaction& tx)
             std::map<std::vector<unsigned char>, std::set<uint256> >::iterator mi = mapNamePending.find(vvch[0]);
             if (mi != mapNamePending.end())
                 mi->second.erase(tx.GetHash());
+            RemovePendingMove(tx);
         }
     }
 }
@@ -2863,7 +2874,7 @@ bool CHuntercoinHooks::GenesisBlock(CBlock& block)
     block = CBlock();
     block.hashPrevBlock = 0;
     block.nVersion = 1;
-    block.nBits    = bnInitialHashTarget[0].GetCompact();
+    block.nBits    = nInitialHashTarget[0].GetCompact();
     CTransaction txNew;
     txNew.vin.resize(1);
     txNew.vout.resize(1);
@@ -2916,6 +2927,12 @@ bool CHuntercoinHooks::Lockin(int nHeight, uint256 hash)
     return true;
 }
 
+uint256 CHuntercoinHooks::AssumeValid()
+{
+    /* Like the lockins, no known-good block is compiled in so far.  */
+    return 0;
+}
+
 string CHuntercoinHooks::IrcPrefix()
 {
     return "huntercoin";
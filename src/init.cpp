@@ -7,6 +7,7 @@
 #include "net.h"
 #include "init.h"
 #include "strlcpy.h"
+#include "cryptopp/cpu.h"
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
@@ -61,6 +62,8 @@ void Shutdown(void* parg)
         nTransactionsUpdated++;
         DBFlush(false);
         StopNode();
+        FlushUtxoCache();
+        WriteBlockIndexSnapshot();
         DBFlush(true);
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
@@ -90,8 +93,10 @@ void HandleSIGTERM(int)
 
 
 
-// A declaration to avoid including full gamedb.h
+// Declarations to avoid including full gamedb.h
 bool UpgradeGameDB();
+extern int nPruneGameDepth;
+void ThreadPruneGameDB(void* parg);
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -214,6 +219,8 @@ bool AppInit2(int argc, char* argv[])
 
     fDebug = GetBoolArg("-debug");
     fDetachDB = GetBoolArg("-detachdb", true);
+    fDBMaintenance = GetBoolArg("-dbmaintenance", true);
+    nPruneGameDepth = GetArg("-prunegamedepth", 0);
     fAllowDNS = GetBoolArg("-dns");
     std::string strAlgo = GetArg("-algo", "sha256d");
     boost::to_lower(strAlgo);
@@ -249,6 +256,18 @@ bool AppInit2(int argc, char* argv[])
     fNoListen = GetBoolArg("-nolisten");
     fLogTimestamps = GetBoolArg("-logtimestamps");
     fAddressReuse = !GetBoolArg ("-noaddressreuse");
+    nPoWCacheSize = GetArg("-powcache", nPoWCacheSize);
+    nSigCacheSize = GetArg("-sigcachesize", nSigCacheSize);
+    nNameCacheSize = GetArg("-namecachesize", nNameCacheSize);
+    nTxCacheSize = GetArg("-txcachesize", nTxCacheSize);
+    nUtxoCacheSize = GetArg("-utxocachemb", nUtxoCacheSize >> 20) << 20;
+    fMmapBlockFiles = GetBoolArg("-mmapblocks", fMmapBlockFiles);
+
+    nScriptCheckThreads = GetArg("-par", 0);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
     for (int i = 1; i < argc; i++)
         if (!IsSwitchChar(argv[i][0]))
@@ -373,6 +392,21 @@ bool AppInit2(int argc, char* argv[])
 
     hooks = InitHook();
 
+    // Signatures in ancestors of this block are not verified; "0" disables
+    hashAssumeValid = fTestNet ? uint256(0) : hooks->AssumeValid();
+    if (mapArgs.count("-assumevalid"))
+    {
+        const std::string strAssumeValid = mapArgs["-assumevalid"];
+        if (strAssumeValid != "0" && !IsHex(strAssumeValid))
+        {
+            wxMessageBox(_("Invalid block hash for -assumevalid"), "Huntercoin");
+            return false;
+        }
+        hashAssumeValid.SetHex(strAssumeValid);
+    }
+    if (hashAssumeValid != 0)
+        printf("Assuming ancestors of block %s have valid signatures\n", hashAssumeValid.ToString().c_str());
+
     //
     // Load data files
     //
@@ -407,18 +441,31 @@ bool AppInit2(int argc, char* argv[])
         needNameRescan = true;
 
       CNameDB dbName("cr+");
+      if (!needNameRescan)
+        {
+          rpcWarmupStatus = "upgrading name index";
+          if (!dbName.Upgrade ())
+            strErrors += _("Error updating nameindexfull.dat      \n");
+        }
     }
 
-    /* Do the same for the UTXO database.  */
-    bool needUtxoRescan = false;
+    /* Do the same for the UTXO database.  A new one is built from the
+       block chain by CUtxoDB::CatchUp when the block index is loaded.  */
     {
       filesystem::path utxofile = filesystem::path(GetDataDir()) / "utxo.dat";
-      if (!filesystem::exists(utxofile))
-        needUtxoRescan = true;
+      const bool fNewUtxo = !filesystem::exists(utxofile);
 
       CUtxoDB db("cr+");
+      if (fNewUtxo && !db.WriteCacheVersion ())
+        strErrors += _("Error creating utxo.dat      \n");
     }
 
+    sha256_detect();
+#if defined(USE_SSE2)
+    scrypt_detect_sse2(CryptoPP::HasSSE2() ? 1<<26 : 0);
+#endif
+    StartScriptCheckThreads();
+
     /* Load block index.  */
     rpcWarmupStatus = "loading block index";
     printf("Loading block index...\n");
@@ -427,15 +474,6 @@ bool AppInit2(int argc, char* argv[])
         strErrors += _("Error loading blkindex.dat      \n");
     printf(" block index %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
-    /* Now that hte block index is loaded, perform the UTXO
-       set rescan if necessary.  */
-    if (needUtxoRescan)
-      {
-        CUtxoDB db("r+");
-        rpcWarmupStatus = "rescanning for utxo set";
-        db.Rescan ();
-      }
-
     rpcWarmupStatus = "upgrading game db";
     if (!UpgradeGameDB())
         printf("ERROR: GameDB update failed\n");
@@ -523,6 +561,36 @@ bool AppInit2(int argc, char* argv[])
         return false;
     }
 
+    if (GetBoolArg("-benchlookups"))
+    {
+        BenchmarkBlockIndexLookups();
+        return false;
+    }
+
+    if (GetBoolArg("-benchdb"))
+    {
+        BenchmarkDBReads();
+        return false;
+    }
+
+    if (GetBoolArg("-benchblocks"))
+    {
+        BenchmarkBlockDeserialization();
+        return false;
+    }
+
+    if (GetBoolArg("-benchsha256"))
+    {
+        BenchmarkSHA256();
+        return false;
+    }
+
+    if (GetBoolArg("-benchscrypt"))
+    {
+        BenchmarkScrypt();
+        return false;
+    }
+
     if (mapArgs.count("-timeout"))
     {
         int nNewTimeout = GetArg("-timeout", 5000);
@@ -534,7 +602,7 @@ bool AppInit2(int argc, char* argv[])
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -618,6 +686,11 @@ bool AppInit2(int argc, char* argv[])
 
     RandAddSeedPerfmon();
 
+    if (fDBMaintenance && !CreateThread(ThreadDBMaintenance, NULL))
+        printf("Error: CreateThread(ThreadDBMaintenance) failed\n");
+    if (nPruneGameDepth > 0 && !CreateThread(ThreadPruneGameDB, NULL))
+        printf("Error: CreateThread(ThreadPruneGameDB) failed\n");
+
     if (!CreateThread(StartNode, NULL))
         wxMessageBox("Error: CreateThread(StartNode) failed", "Huntercoin");
 
@@ -652,6 +725,18 @@ std::string HelpMessage()
         "  -datadir=<dir>   \t\t  " + _("Specify data directory\n") +
         "  -dbcache=<n>     \t\t  " + _("Set database cache size in megabytes (default: 25)") + "\n" +
         "  -dblogsize=<n>   \t\t  " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
+        "  -dbmaintenance   \t\t  " + _("Checkpoint the database in a background thread (default: 1)") + "\n" +
+        "  -dbcheckpointmins=<n>\t  " + _("Checkpoint the database at least every <n> minutes if it was written to (default: 2)") + "\n" +
+        "  -dbtrickle=<n>   \t\t  " + _("Keep <n> percent of the database cache written out in the background (default: 10)") + "\n" +
+        "  -prunegamedepth=<n>\t  " + _("Remove game states older than <n> blocks (at least 2000) in the background, 0 to disable (default: 0)") + "\n" +
+        "  -powcache=<n>    \t\t  " + _("Remember the proof-of-work of up to <n> blocks read from disk (default: 5000)") + "\n" +
+        "  -sigcachesize=<n>\t\t  " + _("Remember up to <n> verified signatures (default: 50000)") + "\n" +
+        "  -namecachesize=<n>\t  " + _("Keep the current state of up to <n> names in memory (default: 20000)") + "\n" +
+        "  -txcachesize=<n>  \t  " + _("Keep up to <n> recently read transactions in memory (default: 10000)") + "\n" +
+        "  -utxocachemb=<n> \t\t  " + _("Keep up to <n> megabytes of UTXO changes in memory before writing them out (default: 64)") + "\n" +
+        "  -mmapblocks      \t\t  " + _("Map finished block files into memory for reading (default: 1 on 64-bit systems)") + "\n" +
+        "  -assumevalid=<hash>\t  " + _("Skip signature checks for ancestors of this block (0 = verify all)") + "\n" +
+        "  -par=<n>         \t\t  " + _("Number of script and move verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
         "  -timeout=<n>     \t  "   + _("Specify connection timeout (in milliseconds)\n") +
         "  -proxy=<ip:port> \t  "   + _("Connect through socks4 proxy\n") +
         "  -dns             \t  "   + _("Allow DNS lookups for addnode and connect\n") +
@@ -9,11 +9,16 @@
 #include "cryptopp/sha.h"
 #include "gamedb.h"
 #include "huntercoin.h"
+#include "checkqueue.h"
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
 #include <cassert>
 
+#ifndef __WXMSW__
+#include <sys/mman.h>
+#endif
+
 using namespace std;
 using namespace boost;
 
@@ -29,20 +34,20 @@ CCriticalSection cs_main;
 // Game can append transactions to the block file
 CCriticalSection cs_AppendBlockFile;
 
-map<uint256, CTransaction> mapTransactions;
+TxMap mapTransactions;
 CCriticalSection cs_mapTransactions;
 unsigned int nTransactionsUpdated = 0;
-map<COutPoint, CInPoint> mapNextTx;
+boost::unordered_map<COutPoint, CInPoint, SaltedOutPointHasher> mapNextTx;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
 uint256 hashGenesisBlock;
-CBigNum bnProofOfWorkLimit[NUM_ALGOS] = { CBigNum(~uint256(0) >> 32), CBigNum(~uint256(0) >> 20) };
-CBigNum bnInitialHashTarget[NUM_ALGOS] = { CBigNum(~uint256(0) >> 32), CBigNum(~uint256(0) >> 20) };
+uint256 nProofOfWorkLimit[NUM_ALGOS] = { ~uint256(0) >> 32, ~uint256(0) >> 20 };
+uint256 nInitialHashTarget[NUM_ALGOS] = { ~uint256(0) >> 32, ~uint256(0) >> 20 };
 const int nInitialBlockThreshold = 0; // Regard blocks up until N-threshold as "initial download"
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
-CBigNum bnBestChainWork = 0;
-CBigNum bnBestInvalidWork = 0;
+uint256 nBestChainWork = 0;
+uint256 nBestInvalidWork = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
@@ -53,7 +58,7 @@ CMedianFilter<int> cPeerBlockCounts(8, 0); // Amount of blocks that other nodes
 map<uint256, CBlock*> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 
-map<uint256, CDataStream*> mapOrphanTransactions;
+uint256HashMap<CDataStream*>::type mapOrphanTransactions;
 multimap<uint256, CDataStream*> mapOrphanTransactionsByPrev;
 
 const std::string strMessageMagic = "Bitcoin Signed Message:\n";
@@ -69,6 +74,10 @@ int64 nTransactionFee = 0;
 int64 nMinimumInputValue = 1;
 int fLimitProcessors = false;
 int nLimitProcessors = 1;
+int nPoWCacheSize = 5000;
+bool fMmapBlockFiles = (sizeof(void*) >= 8);
+int nScriptCheckThreads = 0;
+uint256 hashAssumeValid = 0;
 int fMinimizeToTray = true;
 int fMinimizeOnClose = true;
 #if USE_UPNP
@@ -316,7 +325,8 @@ bool CTransaction::ReadFromDisk(CTxDB& txdb, COutPoint prevout)
 
 bool CTransaction::ReadFromDisk(COutPoint prevout)
 {
-    CTxDB txdb("r");
+    CReadDatabaseSet readDbset;
+    CTxDB& txdb = readDbset->tx();
     CTxIndex txindex;
     return ReadFromDisk(txdb, prevout, txindex);
 }
@@ -377,7 +387,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -626,10 +636,96 @@ CTransaction::AcceptToMemoryPool (DatabaseSet& dbset, bool fCheckInputs,
 
 bool CTransaction::AcceptToMemoryPool(bool fCheckInputs, bool* pfMissingInputs)
 {
-    DatabaseSet dbset("r");
+    CReadDatabaseSet readDbset;
+    DatabaseSet& dbset = *readDbset;
     return AcceptToMemoryPool (dbset, fCheckInputs, pfMissingInputs);
 }
 
+//
+// Priority index of the memory pool, used by CreateNewBlock.  The priority
+// of a transaction is sum(valuein * age) / txsize over its confirmed inputs.
+// Since all confirmed inputs age by one with each block, it is kept as the
+// sums of valuein and valuein * height, which stay the same until the
+// inputs change.  Inputs that are not confirmed yet are dependencies.  Both
+// are read from the UTXO set only for entries that are stale, which are new
+// transactions and those whose inputs were affected by changes to the pool
+// or the chain.  Everything here is guarded by cs_mapTransactions.
+//
+
+class CTxPriority
+{
+public:
+    double dValueIn;
+    double dValueHeight;
+    unsigned int nTxSize;
+    set<uint256> setDependsOn;
+
+    CTxPriority()
+    {
+        dValueIn = 0;
+        dValueHeight = 0;
+        nTxSize = 1;
+    }
+
+    double GetPriority(int nHeight) const
+    {
+        return (dValueIn * (1 + nHeight) - dValueHeight) / nTxSize;
+    }
+};
+
+static uint256HashMap<CTxPriority>::type mapTxPriority;
+static set<uint256> setTxPriorityStale;
+
+// Mark pool transactions spending outputs of tx as stale.  They depend on
+// whether tx is confirmed or in the pool.
+static void MarkSpendersStale(const CTransaction& tx)
+{
+    const uint256 hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        boost::unordered_map<COutPoint, CInPoint, SaltedOutPointHasher>::const_iterator mi;
+        mi = mapNextTx.find(COutPoint(hash, i));
+        if (mi != mapNextTx.end())
+            setTxPriorityStale.insert(mi->second.ptx->GetHash());
+    }
+}
+
+static void MarkAllPriorityStale()
+{
+    CRITICAL_BLOCK(cs_mapTransactions)
+        for (TxMap::const_iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
+            setTxPriorityStale.insert(mi->first);
+}
+
+static void UpdateTxPriority(DatabaseSet& dbset)
+{
+    BOOST_FOREACH(const uint256& hash, setTxPriorityStale)
+    {
+        TxMap::const_iterator mi = mapTransactions.find(hash);
+        if (mi == mapTransactions.end())
+            continue;
+        const CTransaction& tx = mi->second;
+
+        CTxPriority& prio = mapTxPriority[hash];
+        prio = CTxPriority();
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            CUtxoEntry txo;
+            if (!dbset.utxo ().ReadUtxo (txin.prevout, txo))
+            {
+                prio.setDependsOn.insert(txin.prevout.hash);
+                continue;
+            }
+
+            const double dValueIn = static_cast<double> (txo.txo.nValue);
+            prio.dValueIn += dValueIn;
+            prio.dValueHeight += dValueIn * txo.height;
+        }
+        prio.nTxSize = ::GetSerializeSize(tx, SER_NETWORK);
+    }
+    setTxPriorityStale.clear();
+}
+
 bool CTransaction::AddToMemoryPoolUnchecked()
 {
     // Add to memory pool without checking anything.  Don't call this directly,
@@ -637,9 +733,15 @@ bool CTransaction::AddToMemoryPoolUnchecked()
     CRITICAL_BLOCK(cs_mapTransactions)
     {
         uint256 hash = GetHash();
-        mapTransactions[hash] = *this;
+        CTransaction& txPool = mapTransactions[hash];
+        txPool = *this;
+        // Transactions in the pool are never modified, so their hash
+        // need not be computed again.
+        txPool.Freeze();
         for (int i = 0; i < vin.size(); i++)
-            mapNextTx[vin[i].prevout] = CInPoint(&mapTransactions[hash], i);
+            mapNextTx[vin[i].prevout] = CInPoint(&txPool, i);
+        setTxPriorityStale.insert(hash);
+        MarkSpendersStale(txPool);
         nTransactionsUpdated++;
     }
     return true;
@@ -655,7 +757,11 @@ bool CTransaction::RemoveFromMemoryPool()
     {
         BOOST_FOREACH(const CTxIn& txin, vin)
             mapNextTx.erase(txin.prevout);
-        mapTransactions.erase(GetHash());
+        const uint256 hash = GetHash();
+        mapTransactions.erase(hash);
+        mapTxPriority.erase(hash);
+        setTxPriorityStale.erase(hash);
+        MarkSpendersStale(*this);
         nTransactionsUpdated++;
     }
     return true;
@@ -677,7 +783,7 @@ ClearDoubleSpendings (const std::set<COutPoint>& outs)
     {
       BOOST_FOREACH (const COutPoint& out, outs)
         {
-          std::map<COutPoint, CInPoint>::const_iterator mi;
+          boost::unordered_map<COutPoint, CInPoint, SaltedOutPointHasher>::const_iterator mi;
           mi = mapNextTx.find (out);
           if (mi != mapNextTx.end ())
             {
@@ -713,7 +819,7 @@ int CMerkleTx::GetDepthInMainChain(int& nHeightRet) const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -765,7 +871,8 @@ CMerkleTx::AcceptToMemoryPool (DatabaseSet& dbset, bool fCheckInputs)
 
 bool CMerkleTx::AcceptToMemoryPool()
 {
-    DatabaseSet dbset("r");
+    CReadDatabaseSet readDbset;
+    DatabaseSet& dbset = *readDbset;
     return AcceptToMemoryPool (dbset);
 }
 
@@ -794,7 +901,8 @@ CWalletTx::AcceptWalletTransaction (DatabaseSet& dbset, bool fCheckInputs)
 
 bool CWalletTx::AcceptWalletTransaction()
 {
-    DatabaseSet dbset("r");
+    CReadDatabaseSet readDbset;
+    DatabaseSet& dbset = *readDbset;
     return AcceptWalletTransaction (dbset);
 }
 
@@ -807,7 +915,7 @@ CTxIndex::GetContainingBlock () const
         return NULL;
 
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return NULL;
 
@@ -842,7 +950,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     {
         CRITICAL_BLOCK(cs_mapTransactions)
         {
-            std::map<uint256, CTransaction>::iterator mi = mapTransactions.find(hash);
+            TxMap::iterator mi = mapTransactions.find(hash);
             if (mi != mapTransactions.end())
             {
                 txOut = mi->second;
@@ -850,7 +958,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
             }
         }
 
-        CTxDB txdb("r");
+        CReadDatabaseSet readDbset;
+        CTxDB& txdb = readDbset->tx();
         CTxIndex txindex;
 
         if (txdb.ReadTxIndex(hash, txindex) && txOut.ReadFromDisk(txindex.pos))
@@ -879,6 +988,41 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
+// Block index objects are never freed, so we allocate them in large
+// contiguous chunks instead of one by one.  This saves the per-object
+// heap overhead and keeps the index compact in memory.
+static const unsigned int BLOCKINDEX_CHUNK_SIZE = 4096;
+static CCriticalSection cs_blockIndexArena;
+static CBlockIndex* pblockIndexChunk = NULL;
+static unsigned int nBlockIndexChunkUsed = 0;
+static unsigned int nBlockIndexChunkSize = 0;
+
+void ReserveBlockIndexArena(unsigned int nCount)
+{
+    CRITICAL_BLOCK(cs_blockIndexArena)
+    {
+        // The remainder of the previous chunk is simply left unused.
+        if (nBlockIndexChunkSize - nBlockIndexChunkUsed < nCount)
+        {
+            nBlockIndexChunkSize = max(nCount, BLOCKINDEX_CHUNK_SIZE);
+            pblockIndexChunk = new CBlockIndex[nBlockIndexChunkSize];
+            nBlockIndexChunkUsed = 0;
+        }
+    }
+}
+
+CBlockIndex* AllocateBlockIndex()
+{
+    CBlockIndex* pindex;
+    CRITICAL_BLOCK(cs_blockIndexArena)
+    {
+        if (nBlockIndexChunkUsed == nBlockIndexChunkSize)
+            ReserveBlockIndexArena(1);
+        pindex = &pblockIndexChunk[nBlockIndexChunkUsed++];
+    }
+    return pindex;
+}
+
 static CBlockIndex* pblockindexFBBHLast;
 CBlockIndex* FindBlockByHeight(int nHeight)
 {
@@ -897,38 +1041,178 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return pblockindex;
 }
 
+/* Blocks whose proof-of-work has been checked when reading them from disk,
+   together with the position they were read from.  This is only consulted
+   for blocks that can't be matched against mapBlockIndex.  */
+static map<uint256, pair<unsigned int, unsigned int> > mapPoWVerified;
+static CCriticalSection cs_mapPoWVerified;
+
+/* Check whether a block header read from the given disk position can be
+   trusted without verifying its proof-of-work again.  This is the case if
+   the block index already has the block at exactly this position (it was
+   fully checked when it was accepted), or if we verified it earlier.  */
+static bool
+IsTrustedOnDisk (const uint256& hash, unsigned int nFile, unsigned int nBlockPos)
+{
+  bool fTrusted = false;
+
+  /* Only try to lock cs_main.  Most callers hold it already, and for the
+     others we rather do the check than risk a lock-order problem.  */
+  TRY_CRITICAL_BLOCK(cs_main)
+    {
+      const BlockMap::const_iterator mi
+        = mapBlockIndex.find (hash);
+      if (mi != mapBlockIndex.end ())
+        {
+          const CBlockIndex* pindex = mi->second;
+          fTrusted = (pindex->nFile == nFile && pindex->nBlockPos == nBlockPos);
+        }
+    }
+  if (fTrusted || nPoWCacheSize <= 0)
+    return fTrusted;
+
+  CRITICAL_BLOCK(cs_mapPoWVerified)
+    {
+      const map<uint256, pair<unsigned int, unsigned int> >::const_iterator mi
+        = mapPoWVerified.find (hash);
+      fTrusted = (mi != mapPoWVerified.end ()
+                  && mi->second == make_pair (nFile, nBlockPos));
+    }
+
+  return fTrusted;
+}
+
+static void
+MarkVerifiedOnDisk (const uint256& hash, unsigned int nFile, unsigned int nBlockPos)
+{
+  if (nPoWCacheSize <= 0)
+    return;
+
+  CRITICAL_BLOCK(cs_mapPoWVerified)
+    {
+      /* Evict a random entry.  Always taking the lowest hash would keep
+         evicting the blocks with the most work, which are just as likely
+         to be read again as others.  */
+      while (mapPoWVerified.size () >= static_cast<unsigned> (nPoWCacheSize))
+        {
+          uint256 hashRand;
+          RAND_bytes ((unsigned char*)&hashRand, sizeof (hashRand));
+          map<uint256, pair<unsigned int, unsigned int> >::iterator mi
+            = mapPoWVerified.lower_bound (hashRand);
+          if (mi == mapPoWVerified.end ())
+            mi = mapPoWVerified.begin ();
+          mapPoWVerified.erase (mi);
+        }
+      mapPoWVerified[hash] = make_pair (nFile, nBlockPos);
+    }
+}
+
+// Turn the lowest '1' bit in the binary representation of a number into a '0'.
+static inline int InvertLowestOne(int n)
+{
+    return n & (n - 1);
+}
+
+// Compute what height to jump back to with the CBlockIndex::pskip pointer.
+static inline int GetSkipHeight(int height)
+{
+    if (height < 2)
+        return 0;
+
+    // Determine which height to jump back to.  Any number strictly lower than
+    // height is acceptable, but the following expression seems to perform
+    // well in simulations (max 110 steps to go back up to 2**18 blocks).
+    return (height & 1) ? InvertLowestOne(InvertLowestOne(height - 1)) + 1
+                        : InvertLowestOne(height);
+}
+
+CBlockIndex* CBlockIndex::GetAncestor(int height)
+{
+    if (height > nHeight || height < 0)
+        return NULL;
+
+    CBlockIndex* pindexWalk = this;
+    int heightWalk = nHeight;
+    while (heightWalk > height)
+    {
+        int heightSkip = GetSkipHeight(heightWalk);
+        int heightSkipPrev = GetSkipHeight(heightWalk - 1);
+        if (pindexWalk->pskip != NULL
+            && (heightSkip == height
+                || (heightSkip > height && !(heightSkipPrev < heightSkip - 2
+                                             && heightSkipPrev >= height))))
+        {
+            // Only follow pskip if pprev->pskip isn't better than pskip->pprev.
+            pindexWalk = pindexWalk->pskip;
+            heightWalk = heightSkip;
+        }
+        else
+        {
+            assert(pindexWalk->pprev);
+            pindexWalk = pindexWalk->pprev;
+            heightWalk--;
+        }
+    }
+    return pindexWalk;
+}
+
+const CBlockIndex* CBlockIndex::GetAncestor(int height) const
+{
+    return const_cast<CBlockIndex*>(this)->GetAncestor(height);
+}
+
+void CBlockIndex::BuildSkip()
+{
+    if (!pprev)
+    {
+        pskip = NULL;
+        for (int i = 0; i < NUM_ALGOS; ++i)
+            pprevAlgo[i] = NULL;
+        return;
+    }
+
+    pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+    for (int i = 0; i < NUM_ALGOS; ++i)
+        pprevAlgo[i] = (pprev->GetAlgo() == i ? pprev : pprev->pprevAlgo[i]);
+}
+
 bool CBlock::ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions /* = true*/)
 {
     SetNull();
 
     // Open history file to read
-    CAutoFile filein = OpenBlockFile(nFile, nBlockPos, "rb");
+    CBlockFileReader filein(nFile, nBlockPos);
     if (!filein)
-        return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+        return error("CBlock::ReadFromDisk() : opening block file failed");
     if (!fReadTransactions)
         filein.nType |= SER_BLOCKHEADERONLY;
 
     // Read block
     filein >> *this;
 
-    // Check the header
-    if (!CheckProofOfWork(INT_MAX))
-        return error("CBlock::ReadFromDisk() : errors in block header");
+    // Check the header.  Blocks that are already known at this position
+    // have been verified before, so don't redo the (scrypt) proof-of-work.
+    const uint256 hash = GetHash();
+    if (!IsTrustedOnDisk(hash, nFile, nBlockPos))
+    {
+        if (!CheckProofOfWork(INT_MAX))
+            return error("CBlock::ReadFromDisk() : errors in block header");
+        MarkVerifiedOnDisk(hash, nFile, nBlockPos);
+    }
 
-    if (fReadTransactions && nGameTxFile != -1)
+    if (fReadTransactions && nGameTxFile != BLOCKFILE_NONE)
     {
         // If same file, do not reopen
         if (nFile == nGameTxFile)
         {
-            if (fseek(filein, nGameTxPos, SEEK_SET) != 0)
-                return error("CBlock::ReadFromDisk() : fseek failed when trying to read game transactions (nFile=%d, nBlockPos=%d, nGameTxFile=%d, nGameTxPos=%d)", nFile, nBlockPos, nGameTxFile, nGameTxPos);
+            filein.Seek(nGameTxPos);
             filein >> vgametx;
         }
         else
         {
-            CAutoFile filein2 = OpenBlockFile(nGameTxFile, nGameTxPos, "rb");
+            CBlockFileReader filein2(nGameTxFile, nGameTxPos);
             if (!filein2)
-                return error("CBlock::ReadFromDisk() : OpenBlockFile failed when trying to read game transactions (nFile=%d, nBlockPos=%d, nGameTxFile=%d, nGameTxPos=%d)", nFile, nBlockPos, nGameTxFile, nGameTxPos);
+                return error("CBlock::ReadFromDisk() : opening block file failed when trying to read game transactions (nFile=%d, nBlockPos=%d, nGameTxFile=%d, nGameTxPos=%d)", nFile, nBlockPos, nGameTxFile, nGameTxPos);
             filein2 >> vgametx;
         }
     }
@@ -984,23 +1268,24 @@ int64 GetBlockValue(int nHeight, int64 nFees)
     return nSubsidy + nFees;
 }
 
+// Return the last block of the given algo at or before pindex, or the
+// genesis block if there is none.
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, int algo)
 {
-    while (pindex && pindex->pprev && (pindex->GetAlgo() != algo))
-        pindex = pindex->pprev;
-    return pindex;
+    const CBlockIndex* pindexAlgo = GetLastBlockIndexForAlgo(pindex, algo);
+    if (pindexAlgo)
+        return pindexAlgo;
+    return (pindex ? pindex->GetAncestor(0) : NULL);
 }
 
+// Return the last block of the given algo at or before pindex, or NULL.
 const CBlockIndex* GetLastBlockIndexForAlgo(const CBlockIndex* pindex, int algo)
 {
-    for (;;)
-    {
-        if (!pindex)
-            return NULL;
-        if (pindex->GetAlgo() == algo)
-            return pindex;
-        pindex = pindex->pprev;
-    }
+    if (!pindex)
+        return NULL;
+    if (pindex->GetAlgo() == algo)
+        return pindex;
+    return pindex->pprevAlgo[algo];
 }
 
 // PPCoin-style retarget with dual algo support,
@@ -1008,19 +1293,21 @@ const CBlockIndex* GetLastBlockIndexForAlgo(const CBlockIndex* pindex, int algo)
 unsigned int static GetNextWorkRequired(const CBlockIndex* pindexLast, int algo)
 {
     if (pindexLast == NULL)
-        return bnInitialHashTarget[algo].GetCompact(); // genesis block
+        return nInitialHashTarget[algo].GetCompact(); // genesis block
 
     const CBlockIndex* pindexPrev = GetLastBlockIndex(pindexLast, algo);
     if (pindexPrev->pprev == NULL)
-        return bnInitialHashTarget[algo].GetCompact(); // first block
+        return nInitialHashTarget[algo].GetCompact(); // first block
     const CBlockIndex* pindexPrevPrev = GetLastBlockIndex(pindexPrev->pprev, algo);
     if (pindexPrevPrev->pprev == NULL)
-        return bnInitialHashTarget[algo].GetCompact(); // second block
+        return nInitialHashTarget[algo].GetCompact(); // second block
 
     int64 nActualSpacing = pindexPrev->GetBlockTime() - pindexPrevPrev->GetBlockTime();
 
     // ppcoin: target change every block
     // ppcoin: retarget with exponential moving toward target spacing
+    // This is kept in CBigNum since nActualSpacing may be negative, and the
+    // signed intermediate result is part of the consensus rules.
     CBigNum bnNew;
     bnNew.SetCompact(pindexPrev->nBits);
 
@@ -1031,23 +1318,26 @@ unsigned int static GetNextWorkRequired(const CBlockIndex* pindexLast, int algo)
     bnNew *= ((nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing);
     bnNew /= ((nInterval + 1) * nTargetSpacing);
 
-    if (bnNew > bnProofOfWorkLimit[algo])
-        bnNew = bnProofOfWorkLimit[algo];
+    const CBigNum bnLimit(nProofOfWorkLimit[algo]);
+    if (bnNew > bnLimit)
+        bnNew = bnLimit;
 
     return bnNew.GetCompact();
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, int algo)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative;
+    bool fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > bnProofOfWorkLimit[algo])
+    if (fNegative || fOverflow || bnTarget == 0 || bnTarget > nProofOfWorkLimit[algo])
         return error("CheckProofOfWork(algo=%d) : nBits below minimum work", algo);
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (hash > bnTarget)
         return error("CheckProofOfWork(algo=%s) : hash doesn't match nBits", algo);
 
     return true;
@@ -1082,17 +1372,17 @@ bool IsInitialBlockDownload()
 
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
-    if (pindexNew->bnChainWork > bnBestInvalidWork)
+    if (pindexNew->nChainWork > nBestInvalidWork)
     {
-        bnBestInvalidWork = pindexNew->bnChainWork;
-        CTxDB().WriteBestInvalidWork(bnBestInvalidWork);
+        nBestInvalidWork = pindexNew->nChainWork;
+        CTxDB().WriteBestInvalidWork(nBestInvalidWork);
 #ifdef GUI
         uiInterface.NotifyBlocksChanged();
 #endif
     }
-    printf("InvalidChainFound: invalid block=%s  height=%d  work=%s\n", pindexNew->GetBlockHash().ToString().substr(0,20).c_str(), pindexNew->nHeight, pindexNew->bnChainWork.ToString().c_str());
-    printf("InvalidChainFound:  current best=%s  height=%d  work=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainWork.ToString().c_str());
-    if (pindexBest && bnBestInvalidWork > bnBestChainWork + pindexBest->GetBlockWork() * 6)
+    printf("InvalidChainFound: invalid block=%s  height=%d  work=%s\n", pindexNew->GetBlockHash().ToString().substr(0,20).c_str(), pindexNew->nHeight, pindexNew->nChainWork.ToString().c_str());
+    printf("InvalidChainFound:  current best=%s  height=%d  work=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, nBestChainWork.ToString().c_str());
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWork() * 6)
         printf("InvalidChainFound: WARNING: Displayed transactions may not be correct!  You may need to upgrade, or other nodes may need to upgrade.\n");
 }
 
@@ -1157,10 +1447,47 @@ CTransaction::DisconnectInputs (DatabaseSet& dbset, CBlockIndex* pindex)
     return true;
 }
 
+// Allocated when the threads are started and never freed, since the
+// (detached) worker threads keep waiting on it until the process exits.
+static CCheckQueue<CScriptCheck>* pscriptcheckqueue = NULL;
+
+bool CScriptCheck::operator()() const
+{
+    if (!VerifySignature(txoFrom, *ptxTo, nIn, nHashType))
+        return error("CScriptCheck() : %s VerifySignature failed on input %u", ptxTo->GetHash().ToString().substr(0,10).c_str(), nIn);
+    return true;
+}
+
+static void ThreadScriptCheck(void* parg)
+{
+    printf("ThreadScriptCheck started\n");
+    pscriptcheckqueue->Thread();
+}
+
+void StartScriptCheckThreads()
+{
+    // The thread calling ConnectBlock takes part in the verification,
+    // so only nScriptCheckThreads - 1 additional threads are needed.
+    if (nScriptCheckThreads <= 1)
+    {
+        nScriptCheckThreads = 0;
+        return;
+    }
+    printf("Using %d threads for script verification\n", nScriptCheckThreads);
+    pscriptcheckqueue = new CCheckQueue<CScriptCheck>(128);
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        if (!CreateThread(ThreadScriptCheck, NULL))
+            printf("Error: CreateThread(ThreadScriptCheck) failed\n");
+
+    // Moves of the game are checked in parallel as well
+    StartMoveCheckThreads();
+}
+
 bool
 CTransaction::ConnectInputs (DatabaseSet& dbset, CTestPool& testPool,
     CDiskTxPos posThisTx, CBlockIndex* pindexBlock, int64& nFees,
-    bool fBlock, bool fMiner, int64 nMinFee)
+    bool fBlock, bool fMiner, int64 nMinFee,
+    std::vector<CScriptCheck>* pvChecks, bool fScriptChecks)
 {
     // Take over previous transactions' spent pointers
     if (!IsCoinBase())
@@ -1266,9 +1593,14 @@ CTransaction::ConnectInputs (DatabaseSet& dbset, CTestPool& testPool,
                                     " at depth %d", heightDiff);
                   }
 
-                // Verify signature
-                if (!VerifySignature (txo.txo, *this, i))
-                    return error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
+                // Verify signature (or defer it to the script check threads)
+                if (fScriptChecks)
+                {
+                    if (pvChecks)
+                        pvChecks->push_back(CScriptCheck(txo.txo, *this, i, 0));
+                    else if (!VerifySignature (txo.txo, *this, i))
+                        return error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
+                }
 
                 // Check for negative or overflow input values
                 nValueIn += txo.txo.nValue;
@@ -1415,6 +1747,32 @@ CBlock::DisconnectBlock (DatabaseSet& dbset, CBlockIndex* pindex)
     return true;
 }
 
+// Check whether pindex is an ancestor of the assumed-valid block, in which
+// case the signatures in it need not be verified.  Everything else (UTXO,
+// names, game state) is still processed as usual.  The assumed-valid block
+// may not be in the index yet when the blocks arrived out of order, so we
+// also follow the orphan blocks back to the known part of the chain.
+static bool IsAssumedValid(const CBlockIndex* pindex)
+{
+    if (hashAssumeValid == 0)
+        return false;
+
+    uint256 hash = hashAssumeValid;
+    for (unsigned int i = 0; i <= mapOrphanBlocks.size(); i++)
+    {
+        BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end())
+            return mi->second->GetAncestor(pindex->nHeight) == pindex;
+
+        map<uint256, CBlock*>::const_iterator mo = mapOrphanBlocks.find(hash);
+        if (mo == mapOrphanBlocks.end())
+            return false;
+        hash = mo->second->hashPrevBlock;
+    }
+
+    return false;
+}
+
 bool
 CBlock::ConnectBlock (DatabaseSet& dbset, CBlockIndex* pindex)
 {
@@ -1425,6 +1783,13 @@ CBlock::ConnectBlock (DatabaseSet& dbset, CBlockIndex* pindex)
     //// issue here: it doesn't know the version
     unsigned int nTxPos = pindex->nBlockPos + ::GetSerializeSize(*this, SER_DISK|SER_BLOCKHEADERONLY) + GetSizeOfCompactSize(vtx.size());
 
+    // The UTXO bookkeeping is done in order here, while the signature
+    // checks are queued for the script check threads as we go.  The
+    // control object waits for them in any case before we return.
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? pscriptcheckqueue : NULL);
+    std::vector<CScriptCheck> vChecks;
+    const bool fScriptChecks = !IsAssumedValid(pindex);
+
     CTestPool poolUnused;
     int64 nFees = 0;
     BOOST_FOREACH(CTransaction& tx, vtx)
@@ -1433,8 +1798,10 @@ CBlock::ConnectBlock (DatabaseSet& dbset, CBlockIndex* pindex)
         nTxPos += ::GetSerializeSize(tx, SER_DISK);
 
         if (!tx.ConnectInputs (dbset, poolUnused, posThisTx, pindex,
-                               nFees, true, false))
+                               nFees, true, false, 0, &vChecks,
+                               fScriptChecks))
             return false;
+        control.Add(vChecks);
     }
 
     int64 nFeesBeforeTax = nFees;
@@ -1443,6 +1810,9 @@ CBlock::ConnectBlock (DatabaseSet& dbset, CBlockIndex* pindex)
     if (!hooks->ConnectBlock(*this, dbset, pindex, nFees, nTxPos))
         return error("ConnectBlock() : hook failed");
 
+    if (!control.Wait())
+        return error("ConnectBlock() : signature verification failed");
+
     // nFees may include taxes from the game, so we check it after creating game transactions
     if (pindex->nHeight && vtx[0].GetValueOut() > GetBlockValue(pindex->nHeight, nFees))
     {
@@ -1478,16 +1848,18 @@ Reorganize (DatabaseSet& dbset, CBlockIndex* pindexNew)
 {
     printf("REORGANIZE\n");
 
-    // Find the fork
+    // Find the fork.  First jump to the same height via the skip pointers,
+    // then walk back on both branches in lockstep.
     CBlockIndex* pfork = pindexBest;
     CBlockIndex* plonger = pindexNew;
+    if (plonger->nHeight > pfork->nHeight)
+        plonger = plonger->GetAncestor(pfork->nHeight);
+    else if (pfork->nHeight > plonger->nHeight)
+        pfork = pfork->GetAncestor(plonger->nHeight);
     while (pfork != plonger)
     {
-        while (plonger->nHeight > pfork->nHeight)
-            if (!(plonger = plonger->pprev))
-                return error("Reorganize() : plonger->pprev is null");
-        if (pfork == plonger)
-            break;
+        if (!(plonger = plonger->pprev))
+            return error("Reorganize() : plonger->pprev is null");
         if (!(pfork = pfork->pprev))
             return error("Reorganize() : pfork->pprev is null");
     }
@@ -1574,6 +1946,9 @@ Reorganize (DatabaseSet& dbset, CBlockIndex* pindexNew)
         tx.RemoveFromMemoryPool();
     ClearDoubleSpendings (setSpent);
 
+    // Confirmed inputs of the remaining pool transactions may have moved
+    MarkAllPriorityStale();
+
     return true;
 }
 
@@ -1629,10 +2004,10 @@ CBlock::SetBestChain (DatabaseSet& dbset, CBlockIndex* pindexNew)
     hashBestChain = hash;
     pindexBest = pindexNew;
     nBestHeight = pindexBest->nHeight;
-    bnBestChainWork = pindexNew->bnChainWork;
+    nBestChainWork = pindexNew->nChainWork;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
-    printf("SetBestChain: new best=%s  height=%d  work=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainWork.ToString().c_str());
+    printf("SetBestChain: new best=%s  height=%d  work=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, nBestChainWork.ToString().c_str());
 
     // Update best block in wallet (so we can detect restored wallets)
     if (!IsInitialBlockDownload())
@@ -1658,18 +2033,18 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return error("AddToBlockIndex() : %s already exists", hash.ToString().substr(0,20).c_str());
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
-    if (!pindexNew)
-        return error("AddToBlockIndex() : new CBlockIndex failed");
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CBlockIndex* pindexNew = AllocateBlockIndex();
+    *pindexNew = CBlockIndex(nFile, nBlockPos, *this);
+    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
     }
-    pindexNew->bnChainWork = (pindexNew->pprev ? pindexNew->pprev->bnChainWork : 0) + pindexNew->GetBlockWork();
+    pindexNew->BuildSkip();
+    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWork();
 
     {
       DatabaseSet dbset;
@@ -1679,7 +2054,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return false;
 
       // New best
-      if (pindexNew->bnChainWork > bnBestChainWork)
+      if (pindexNew->nChainWork > nBestChainWork)
         if (!SetBestChain (dbset, pindexNew))
           return false;
     }
@@ -1864,7 +2239,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return error("AcceptBlock() : prev block not found");
     CBlockIndex* pindexPrev = (*mi).second;
@@ -2080,7 +2455,7 @@ CheckDiskSpace (uint64 nAdditionalBytes)
 
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
 {
-    if (nFile == -1)
+    if (nFile == BLOCKFILE_NONE)
         return NULL;
     FILE* file = fopen(strprintf("%s/blk%04d.dat", GetDataDir().c_str(), nFile).c_str(), pszMode);
     if (!file)
@@ -2195,14 +2570,250 @@ void FlushBlockFile(FILE *f)
     }
 }
 
+//
+// Cache of open block files for reading
+//
+
+// Keep at most this many block files open (more if they are all in use)
+static const unsigned int MAX_OPEN_BLOCKFILES = 8;
+// Size of the read buffer for files that are not mapped
+static const unsigned int BLOCKFILE_READ_BUFFER = 64 * 1024;
+
+struct CBlockFile
+{
+    unsigned int nFile;
+    int fd;
+    // Read-only mapping of the whole file, or NULL if not mapped
+    const char* pMap;
+    unsigned int nMapSize;
+    // Number of readers currently using the file
+    int nRefs;
+    list<unsigned int>::iterator itLRU;
+};
+
+static CCriticalSection cs_blockfiles;
+static map<unsigned int, CBlockFile*> mapOpenBlockFiles;
+// Most recently used files are at the front
+static list<unsigned int> lruOpenBlockFiles;
+
+static string GetBlockFilePath(unsigned int nFile)
+{
+    return strprintf("%s/blk%04d.dat", GetDataDir().c_str(), nFile);
+}
+
+static void CloseBlockFile(CBlockFile* pfile)
+{
+#ifndef __WXMSW__
+    if (pfile->pMap)
+        munmap((void*)pfile->pMap, pfile->nMapSize);
+    close(pfile->fd);
+#else
+    _close(pfile->fd);
+#endif
+    delete pfile;
+}
+
+// Close the least recently used files that nobody is reading from until the
+// cache is within its limit again.  cs_blockfiles must be held.
+static void TrimBlockFiles()
+{
+    list<unsigned int>::iterator it = lruOpenBlockFiles.end();
+    while (mapOpenBlockFiles.size() > MAX_OPEN_BLOCKFILES && it != lruOpenBlockFiles.begin())
+    {
+        --it;
+        map<unsigned int, CBlockFile*>::iterator mi = mapOpenBlockFiles.find(*it);
+        assert(mi != mapOpenBlockFiles.end());
+        CBlockFile* pfile = mi->second;
+        if (pfile->nRefs > 0)
+            continue;
+        it = lruOpenBlockFiles.erase(it);
+        mapOpenBlockFiles.erase(mi);
+        CloseBlockFile(pfile);
+    }
+}
+
+// Block files are only ever appended to at nCurrentBlockFile, which never
+// goes back, so all files before it keep their size.  Later files may still
+// be appended to even if a following file exists, since AppendBlockFile
+// starts again at the first file after a restart and may use its reserved
+// space.  In-place updates of game transaction positions are still
+// possible, but those are seen through a shared mapping as well.
+static bool IsBlockFileFinal(unsigned int nFile)
+{
+    return nFile < nCurrentBlockFile;
+}
+
+static CBlockFile* AcquireBlockFile(unsigned int nFile)
+{
+    CRITICAL_BLOCK(cs_blockfiles)
+    {
+        map<unsigned int, CBlockFile*>::iterator mi = mapOpenBlockFiles.find(nFile);
+        if (mi != mapOpenBlockFiles.end())
+        {
+            CBlockFile* pfile = mi->second;
+            ++pfile->nRefs;
+            lruOpenBlockFiles.splice(lruOpenBlockFiles.begin(), lruOpenBlockFiles, pfile->itLRU);
+            return pfile;
+        }
+
+#ifndef __WXMSW__
+        int fd = open(GetBlockFilePath(nFile).c_str(), O_RDONLY);
+#else
+        int fd = _open(GetBlockFilePath(nFile).c_str(), _O_RDONLY | _O_BINARY);
+#endif
+        if (fd < 0)
+            return NULL;
+
+        CBlockFile* pfile = new CBlockFile();
+        pfile->nFile = nFile;
+        pfile->fd = fd;
+        pfile->pMap = NULL;
+        pfile->nMapSize = 0;
+        pfile->nRefs = 1;
+
+#ifndef __WXMSW__
+        struct stat st;
+        if (fMmapBlockFiles && IsBlockFileFinal(nFile)
+            && fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                pfile->pMap = (const char*)p;
+                pfile->nMapSize = st.st_size;
+            }
+            else
+                printf("mmap of block file %u failed, reading it normally\n", nFile);
+        }
+#endif
+
+        lruOpenBlockFiles.push_front(nFile);
+        pfile->itLRU = lruOpenBlockFiles.begin();
+        mapOpenBlockFiles[nFile] = pfile;
+        TrimBlockFiles();
+        return pfile;
+    }
+    return NULL; // not reached
+}
+
+static void ReleaseBlockFile(CBlockFile* pfile)
+{
+    CRITICAL_BLOCK(cs_blockfiles)
+    {
+        --pfile->nRefs;
+        TrimBlockFiles();
+    }
+}
+
+// Read up to nSize bytes at nPos, returns the number read or -1 on error.
+// This does not touch a file position shared with other readers.
+static int ReadBlockFileAt(CBlockFile* pfile, unsigned int nPos, char* pch, unsigned int nSize)
+{
+#ifndef __WXMSW__
+    loop
+    {
+        ssize_t n = pread(pfile->fd, pch, nSize, nPos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        return n;
+    }
+#else
+    CRITICAL_BLOCK(cs_blockfiles)
+    {
+        if (_lseeki64(pfile->fd, nPos, SEEK_SET) != nPos)
+            return -1;
+        return _read(pfile->fd, pch, nSize);
+    }
+    return -1; // not reached
+#endif
+}
+
+CBlockFileReader::CBlockFileReader(unsigned int nFile, unsigned int nPosIn, int nTypeIn, int nVersionIn)
+{
+    pfile = (nFile == BLOCKFILE_NONE ? NULL : AcquireBlockFile(nFile));
+    nPos = nPosIn;
+    nBufStart = nBufEnd = 0;
+    state = 0;
+    exceptmask = std::ios::badbit | std::ios::failbit;
+    nType = nTypeIn;
+    nVersion = nVersionIn;
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    if (pfile)
+        ReleaseBlockFile(pfile);
+}
+
+bool CBlockFileReader::Fill()
+{
+    if (vBuf.empty())
+        vBuf.resize(BLOCKFILE_READ_BUFFER);
+    int n = ReadBlockFileAt(pfile, nPos, &vBuf[0], vBuf.size());
+    if (n <= 0)
+    {
+        nBufStart = nBufEnd = 0;
+        return false;
+    }
+    nBufStart = nPos;
+    nBufEnd = nPos + n;
+    return true;
+}
+
+CBlockFileReader& CBlockFileReader::read(char* pch, int nSize)
+{
+    if (!pfile)
+        throw std::ios_base::failure("CBlockFileReader::read : file not open");
+
+    if (pfile->pMap)
+    {
+        if (nPos > pfile->nMapSize || nSize > pfile->nMapSize - nPos)
+        {
+            setstate(std::ios::failbit, "CBlockFileReader::read : end of file");
+            return (*this);
+        }
+        memcpy(pch, pfile->pMap + nPos, nSize);
+        nPos += nSize;
+        return (*this);
+    }
+
+    while (nSize > 0)
+    {
+        if (nPos < nBufStart || nPos >= nBufEnd)
+        {
+            // Large reads bypass the buffer
+            if (nSize >= BLOCKFILE_READ_BUFFER)
+            {
+                int n = ReadBlockFileAt(pfile, nPos, pch, nSize);
+                if (n <= 0)
+                    break;
+                pch += n;
+                nPos += n;
+                nSize -= n;
+                continue;
+            }
+            if (!Fill())
+                break;
+        }
+        unsigned int n = std::min<unsigned int>(nSize, nBufEnd - nPos);
+        memcpy(pch, &vBuf[nPos - nBufStart], n);
+        pch += n;
+        nPos += n;
+        nSize -= n;
+    }
+    if (nSize > 0)
+        setstate(std::ios::failbit, "CBlockFileReader::read : end of file or read failed");
+    return (*this);
+}
+
 bool LoadBlockIndex(bool fAllowNew)
 {
     if (fTestNet)
     {
-        bnProofOfWorkLimit[ALGO_SHA256D] = CBigNum(~uint256(0) >> 24);
-        bnInitialHashTarget[ALGO_SHA256D] = CBigNum(~uint256(0) >> 24);
-        bnProofOfWorkLimit[ALGO_SCRYPT] = CBigNum(~uint256(0) >> 12);
-        bnInitialHashTarget[ALGO_SCRYPT] = CBigNum(~uint256(0) >> 12);
+        nProofOfWorkLimit[ALGO_SHA256D] = ~uint256(0) >> 24;
+        nInitialHashTarget[ALGO_SHA256D] = ~uint256(0) >> 24;
+        nProofOfWorkLimit[ALGO_SCRYPT] = ~uint256(0) >> 12;
+        nInitialHashTarget[ALGO_SCRYPT] = ~uint256(0) >> 12;
 
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0xbf;
@@ -2240,7 +2851,7 @@ bool LoadBlockIndex(bool fAllowNew)
           /* Go through each blkindex object loaded into memory and
              write it again to disk.  */
           printf ("Updating blkindex.dat data format...\n");
-          map<uint256, CBlockIndex*>::const_iterator mi;
+          BlockMap::const_iterator mi;
           for (mi = mapBlockIndex.begin (); mi != mapBlockIndex.end (); ++mi)
             {
               CDiskBlockIndex disk(mi->second);
@@ -2287,11 +2898,51 @@ bool LoadBlockIndex(bool fAllowNew)
 
 
 
+// Debugging feature:  Compare lookup throughput of mapBlockIndex with
+// an ordered std::map holding the same keys.
+void BenchmarkBlockIndexLookups()
+{
+    const int nRounds = 10;
+
+    vector<uint256> vHashes;
+    vHashes.reserve(mapBlockIndex.size());
+    std::map<uint256, CBlockIndex*> mapOrdered;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+    {
+        vHashes.push_back(item.first);
+        mapOrdered.insert(item);
+    }
+    random_shuffle(vHashes.begin(), vHashes.end(), GetRandInt);
+    if (vHashes.empty())
+        return;
+
+    unsigned int nFound = 0;
+    int64 nStart = GetTimeMillis();
+    for (int i = 0; i < nRounds; ++i)
+        BOOST_FOREACH(const uint256& hash, vHashes)
+            nFound += (mapBlockIndex.find(hash) != mapBlockIndex.end());
+    const int64 nHashed = GetTimeMillis() - nStart;
+
+    nStart = GetTimeMillis();
+    for (int i = 0; i < nRounds; ++i)
+        BOOST_FOREACH(const uint256& hash, vHashes)
+            nFound += (mapOrdered.find(hash) != mapOrdered.end());
+    const int64 nOrdered = GetTimeMillis() - nStart;
+
+    const double dLookups = (double)nRounds * vHashes.size();
+    printf("BenchmarkBlockIndexLookups: %.0f lookups of %u keys (%u found)\n",
+           dLookups, (unsigned)vHashes.size(), nFound);
+    printf("  hashed:  %6"PRI64d"ms  (%.1f ns/lookup)\n",
+           nHashed, nHashed * 1e6 / dLookups);
+    printf("  ordered: %6"PRI64d"ms  (%.1f ns/lookup)\n",
+           nOrdered, nOrdered * 1e6 / dLookups);
+}
+
 void PrintBlockTree()
 {
     // precompute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -2392,7 +3043,7 @@ string GetWarnings(string strFor)
     }
 
     // Longer invalid proof-of-work chain
-    if (pindexBest && bnBestInvalidWork > bnBestChainWork + pindexBest->GetBlockWork() * 6)
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWork() * 6)
     {
         nPriority = 2000;
         strStatusBar = strRPC = "WARNING: Displayed transactions may not be correct!  You may need to upgrade, or other nodes may need to upgrade.";
@@ -2711,7 +3362,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 break;
             }
         }
-        CTxDB txdb("r");
+        CReadDatabaseSet readDbset;
+        CTxDB& txdb = readDbset->tx();
         for (int nInv = 0; nInv < vInv.size(); nInv++)
         {
             const CInv &inv = vInv[nInv];
@@ -2762,7 +3414,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (inv.type == MSG_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -2847,7 +3499,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -3339,7 +3991,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         vector<CInv> vGetData;
         int64 nNow = GetTime() * 1000000;
-        CTxDB txdb("r");
+        CReadDatabaseSet readDbset;
+        CTxDB& txdb = readDbset->tx();
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
             const CInv& inv = (*pto->mapAskFor.begin()).second;
@@ -3442,6 +4095,154 @@ unsigned int static ScanHash_CryptoPP(char* pmidstate, char* pdata, char* phash1
 }
 
 
+// Measures scrypt hashes per second on a single core for the available
+// implementations.
+void BenchmarkScrypt()
+{
+    const int nHashes = 1000;
+
+    vector<char> vInput(2 * 80);
+    vector<char> vOutput(2 * 32);
+    vector<char> vScratchpad(SCRYPT_2WAY_SCRATCHPAD_SIZE);
+    RAND_bytes((unsigned char*)&vInput[0], vInput.size());
+
+    printf("BenchmarkScrypt: %d hashes per implementation, one core\n", nHashes);
+
+    int64 nStart = GetTimeMillis();
+    for (int i = 0; i < nHashes; ++i)
+        scrypt_1024_1_1_256_sp_generic(&vInput[0], &vOutput[0], &vScratchpad[0]);
+    int64 nTime = std::max(GetTimeMillis() - nStart, (int64)1);
+    printf("  generic:          %6"PRI64d"ms  (%.0f hash/s)\n", nTime, nHashes * 1000.0 / nTime);
+
+#if defined(USE_SSE2)
+    if (scrypt_have_sse2)
+    {
+        nStart = GetTimeMillis();
+        for (int i = 0; i < nHashes; ++i)
+            scrypt_1024_1_1_256_sp_sse2(&vInput[0], &vOutput[0], &vScratchpad[0]);
+        nTime = std::max(GetTimeMillis() - nStart, (int64)1);
+        printf("  sse2:             %6"PRI64d"ms  (%.0f hash/s)\n", nTime, nHashes * 1000.0 / nTime);
+    }
+#endif
+
+    nStart = GetTimeMillis();
+    for (int i = 0; i < nHashes; i += 2)
+        scrypt_1024_1_1_256_batch(&vInput[0], &vOutput[0], 2, &vScratchpad[0]);
+    nTime = std::max(GetTimeMillis() - nStart, (int64)1);
+    printf("  batch (2 lanes):  %6"PRI64d"ms  (%.0f hash/s)\n", nTime, nHashes * 1000.0 / nTime);
+}
+
+template<typename Stream>
+static int64 TimeBlockDeserialization(const vector<vector<char> >& vBlocks, int nRounds)
+{
+    const int64 nStart = GetTimeMillis();
+    for (int i = 0; i < nRounds; ++i)
+        BOOST_FOREACH(const vector<char>& vch, vBlocks)
+        {
+            Stream ss(vch, SER_DISK);
+            CBlock block;
+            ss >> block;
+        }
+    return std::max(GetTimeMillis() - nStart, (int64)1);
+}
+
+// Deserializes recent blocks from memory with the plain CDataStream and
+// with the locked buffers of CSecureDataStream, which all streams used
+// before.
+void BenchmarkBlockDeserialization()
+{
+    const int nRounds = 10;
+
+    vector<vector<char> > vBlocks;
+    double dBytes = 0;
+    for (CBlockIndex* pindex = pindexBest; pindex && vBlocks.size() < 500; pindex = pindex->pprev)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            continue;
+        CDataStream ss(SER_DISK);
+        ss << block;
+        vBlocks.push_back(vector<char>(ss.begin(), ss.end()));
+        dBytes += ss.size();
+    }
+    if (vBlocks.empty())
+        return;
+
+    dBytes *= nRounds;
+    printf("BenchmarkBlockDeserialization: %u blocks, %.1f MB in total\n",
+           (unsigned int)(nRounds * vBlocks.size()), dBytes / 1e6);
+
+    int64 nTime = TimeBlockDeserialization<CDataStream>(vBlocks, nRounds);
+    printf("  CDataStream:       %6"PRI64d"ms  (%.1f MB/s)\n", nTime, dBytes / 1e3 / nTime);
+    nTime = TimeBlockDeserialization<CSecureDataStream>(vBlocks, nRounds);
+    printf("  CSecureDataStream: %6"PRI64d"ms  (%.1f MB/s)\n", nTime, dBytes / 1e3 / nTime);
+}
+
+// Compares the generic and batched (multi-lane) SHA-256 code paths for
+// merkle tree nodes and the miner's nonce scanning.
+void BenchmarkSHA256()
+{
+    const int nRounds = 100;
+    const unsigned int nBlocks = 4096;
+
+    vector<unsigned char> vIn(64 * nBlocks);
+    vector<unsigned char> vOutGeneric(32 * nBlocks), vOutBatch(32 * nBlocks);
+    RAND_bytes(&vIn[0], vIn.size());
+
+    int64 nStart = GetTimeMillis();
+    for (int i = 0; i < nRounds; ++i)
+        SHA256D64_generic(&vOutGeneric[0], &vIn[0], nBlocks);
+    const int64 nGeneric = GetTimeMillis() - nStart;
+
+    nStart = GetTimeMillis();
+    for (int i = 0; i < nRounds; ++i)
+        SHA256D64(&vOutBatch[0], &vIn[0], nBlocks);
+    const int64 nBatch = GetTimeMillis() - nStart;
+
+    const double dHashes = (double)nRounds * nBlocks;
+    printf("BenchmarkSHA256: %.0f double hashes of 64 bytes (%s)\n",
+           dHashes, vOutGeneric == vOutBatch ? "results match" : "RESULTS DIFFER");
+    printf("  generic: %6"PRI64d"ms  (%.1f ns/hash)\n",
+           nGeneric, nGeneric * 1e6 / dHashes);
+    printf("  batch:   %6"PRI64d"ms  (%.1f ns/hash)\n",
+           nBatch, nBatch * 1e6 / dHashes);
+
+#if defined(USE_SSE2)
+    // Scan the same nonce range with both miner loops
+    const unsigned int nNonces = 0x400000;
+    char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
+    char pdatabuf[64+16];     char* pdata     = alignup<16>(pdatabuf);
+    char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
+    char phashbuf[32+16];     char* phash     = alignup<16>(phashbuf);
+    RAND_bytes((unsigned char*)pmidstate, 32);
+    RAND_bytes((unsigned char*)pdata, 64);
+    memset(phash1, 0, 64);
+    ((unsigned int*)phash1)[8] = 0x80000000;
+    ((unsigned int*)phash1)[15] = 256;
+
+    int64 nScan[2];
+    for (int fSSE2 = 0; fSSE2 < 2; ++fSSE2)
+    {
+        unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+        nNonce = 0;
+        nStart = GetTimeMillis();
+        while (nNonce < nNonces)
+        {
+            unsigned int nHashesDone = 0;
+            if (fSSE2)
+                ScanHash_4WaySSE2(pmidstate, pdata, phash1, phash, nHashesDone);
+            else
+                ScanHash_CryptoPP(pmidstate, pdata, phash1, phash, nHashesDone);
+        }
+        nScan[fSSE2] = GetTimeMillis() - nStart;
+    }
+    printf("  ScanHash CryptoPP:   %6"PRI64d"ms  (%.2f Mhash/s)\n",
+           nScan[0], nNonces / 1000.0 / std::max(nScan[0], (int64)1));
+    printf("  ScanHash 4-way SSE2: %6"PRI64d"ms  (%.2f Mhash/s)\n",
+           nScan[1], nNonces / 1000.0 / std::max(nScan[1], (int64)1));
+#endif
+}
+
 class COrphan
 {
 public:
@@ -3479,97 +4280,58 @@ void CBlock::SetNull()
     auxpow.reset();
 
     nGameTxFile = nGameTxPos = -1;
+    fFrozen = fHashCached = false;
 }
 
-CBlock* CreateNewBlock(CReserveKey& reservekey, int algo)
+// Transactions (without coinbase) and fees of the last block template.
+// They are reused as long as neither the best chain nor the memory pool
+// change, which saves work for getwork/getauxblock callers that poll often.
+// Guarded by cs_main.
+static CBlockIndex* pindexTemplatePrev = NULL;
+static unsigned int nTemplateTransactionsUpdated = 0;
+static int64 nTemplateTime = 0;
+static vector<CTransaction> vTemplateTx;
+static int64 nTemplateFees = 0;
+
+// Select memory pool transactions for a block on top of pindexPrev in
+// order of priority, and compute the fees including the game tax.
+static void SelectBlockTransactions(CBlockIndex* pindexPrev, vector<CTransaction>& vtx, int64& nFees)
 {
-    // Create new block
-    auto_ptr<CBlock> pblock(new CBlock());
-    if (!pblock.get())
-        return NULL;
-
-    pblock->nVersion = BLOCK_VERSION_DEFAULT | (GetOurChainID(algo) * BLOCK_VERSION_CHAIN_START);
-    switch (algo)
-    {
-        case ALGO_SHA256D:
-            break;
-        case ALGO_SCRYPT:
-            pblock->nVersion |= BLOCK_VERSION_SCRYPT;
-            break;
-        default:
-            error("CreateNewBlock: bad algo");
-            return NULL;
-    }
-
-    // Create coinbase tx
-    CTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey.SetBitcoinAddress(reservekey.GetReservedKey());
-
-    // Add our coinbase tx as first transaction
-    pblock->vtx.push_back(txNew);
-
-    CBlockIndex* pindexPrev;
-
-    // Collect memory pool transactions into the block
-    int64 nFees = 0;
+    vtx.clear();
+    nFees = 0;
 
-    CRITICAL_BLOCK(cs_main)
     CRITICAL_BLOCK(cs_mapTransactions)
     {
-        DatabaseSet dbset("r");
+        CReadDatabaseSet readDbset;
+        DatabaseSet& dbset = *readDbset;
+        UpdateTxPriority(dbset);
 
         // Priority order to process transactions
         list<COrphan> vOrphan; // list memory doesn't move
         map<uint256, vector<COrphan*> > mapDependers;
         multimap<double, CTransaction*> mapPriority;
-        for (map<uint256, CTransaction>::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
+        for (TxMap::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
         {
             CTransaction& tx = (*mi).second;
             if (tx.IsCoinBase() || !tx.IsFinal())
                 continue;
 
+            const CTxPriority& prio = mapTxPriority[(*mi).first];
+            const double dPriority = prio.GetPriority(pindexPrev->nHeight);
+
             COrphan* porphan = NULL;
-            double dPriority = 0;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            if (!prio.setDependsOn.empty())
             {
-                /* Read prev output from UTXO set.  */
-                CUtxoEntry txo;
-                if (!dbset.utxo ().ReadUtxo (txin.prevout, txo))
-                {
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-
-                    assert (!dbset.utxo ().ReadUtxo (txin.prevout, txo));
-                    continue;
-                }
-
-                /* Calculate priority.  */
-                const int64 nValueIn = txo.txo.nValue;
-                const int nConf = 1 + nBestHeight - txo.height;
-                assert (nConf > 0);
-                dPriority += static_cast<double> (nValueIn) * nConf;
-
-                if (fDebug && GetBoolArg("-printpriority"))
-                    printf("priority     nValueIn=%.8f nConf=%d dPriority=%.4f\n", static_cast<double> (nValueIn) / COIN, nConf, dPriority);
-            }
-
-            // Priority is sum(valuein * age) / txsize
-            dPriority /= ::GetSerializeSize(tx, SER_NETWORK);
-
-            if (porphan)
+                // Has to wait for dependencies
+                vOrphan.push_back(COrphan(&tx));
+                porphan = &vOrphan.back();
+                porphan->setDependsOn = prio.setDependsOn;
                 porphan->dPriority = dPriority;
+                BOOST_FOREACH(const uint256& hashPrev, prio.setDependsOn)
+                    mapDependers[hashPrev].push_back(porphan);
+            }
             else
-                mapPriority.insert(make_pair(-dPriority, &(*mi).second));
+                mapPriority.insert(make_pair(-dPriority, &tx));
 
             if (fDebug && GetBoolArg("-printpriority"))
             {
@@ -3582,7 +4344,6 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, int algo)
 
         // If we do not exclude invalid game transactions, the block won't be accepted by ConnectBlock
         // Also we need to compute tax
-        pindexPrev = pindexBest;
         GameStepMiner gameStepMiner(dbset, pindexPrev);
 
         // Collect transactions into block
@@ -3619,7 +4380,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, int algo)
             testPool.swap (tmpPool);
 
             // Added
-            pblock->vtx.push_back(tx);
+            vtx.push_back(tx);
             nBlockSize += nTxSize;
             nBlockSigOps += nTxSigOps;
 
@@ -3642,6 +4403,62 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, int algo)
         int64 nTax = gameStepMiner.ComputeTax();
         nFees += nTax;
     }
+}
+
+CBlock* CreateNewBlock(CReserveKey& reservekey, int algo)
+{
+    // Create new block
+    auto_ptr<CBlock> pblock(new CBlock());
+    if (!pblock.get())
+        return NULL;
+
+    pblock->nVersion = BLOCK_VERSION_DEFAULT | (GetOurChainID(algo) * BLOCK_VERSION_CHAIN_START);
+    switch (algo)
+    {
+        case ALGO_SHA256D:
+            break;
+        case ALGO_SCRYPT:
+            pblock->nVersion |= BLOCK_VERSION_SCRYPT;
+            break;
+        default:
+            error("CreateNewBlock: bad algo");
+            return NULL;
+    }
+
+    // Create coinbase tx
+    CTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey.SetBitcoinAddress(reservekey.GetReservedKey());
+
+    // Add our coinbase tx as first transaction
+    pblock->vtx.push_back(txNew);
+
+    CBlockIndex* pindexPrev;
+
+    // Collect memory pool transactions into the block
+    int64 nFees = 0;
+
+    CRITICAL_BLOCK(cs_main)
+    {
+        pindexPrev = pindexBest;
+        if (pindexPrev != pindexTemplatePrev
+            || nTransactionsUpdated != nTemplateTransactionsUpdated
+            || GetTime() - nTemplateTime > 60)
+        {
+            // IsFinal depends on the time, hence the limit on the age
+            nTemplateTransactionsUpdated = nTransactionsUpdated;
+            nTemplateTime = GetTime();
+            SelectBlockTransactions(pindexPrev, vTemplateTx, nTemplateFees);
+            pindexTemplatePrev = pindexPrev;
+        }
+        else if (fDebug)
+            printf("CreateNewBlock: reusing template with %d transactions\n", (int)vTemplateTx.size());
+
+        pblock->vtx.insert(pblock->vtx.end(), vTemplateTx.begin(), vTemplateTx.end());
+        nFees = nTemplateFees;
+    }
     pblock->vtx[0].vout[0].nValue = GetBlockValue(pindexPrev->nHeight+1, nFees);
 
     // Fill in header
@@ -3720,7 +4537,7 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
 {
     int algo = pblock->GetAlgo();
     uint256 hashBlock = pblock->GetHash();
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
     CAuxPow *auxpow = pblock->auxpow.get();
 
@@ -3849,7 +4666,7 @@ void static BitcoinMiner(CWallet *pwallet)
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
         uint256 hashbuf[2];
         uint256& hash = *alignup<16>(hashbuf);
         loop
@@ -3857,6 +4674,13 @@ void static BitcoinMiner(CWallet *pwallet)
             unsigned int nHashesDone = 0;
             unsigned int nNonceFound;
 
+#if defined(USE_SSE2)
+            // 4-way SSE2 SHA-256
+            if (fSHA256UseSSE2)
+                nNonceFound = ScanHash_4WaySSE2(pmidstate, pdata + 64, phash1,
+                                                (char*)&hash, nHashesDone);
+            else
+#endif
             // Crypto++ SHA-256
             nNonceFound = ScanHash_CryptoPP(pmidstate, pdata + 64, phash1,
                                             (char*)&hash, nHashesDone);
@@ -3987,44 +4811,44 @@ void static ScryptMiner(CWallet *pwallet)
         unsigned int& nBlockTime = *(unsigned int*)(pdata + 64 + 4);
         unsigned int& nBlockBits = *(unsigned int*)(pdata + 64 + 8);
 
+        char pheaders[2 * 80];
+        uint256 phashes[2];
+        vector<char> vScratchpad(SCRYPT_2WAY_SCRATCHPAD_SIZE);
+
         //
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
         loop
         {
             unsigned int nHashesDone = 0;
-            uint256 thash;
-            char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+            bool fFound = false;
             loop
             {
-#if defined(USE_SSE2)
-                // Detection would work, but in cases where we KNOW it always has SSE2,
-                // it is faster to use directly than to use a function pointer or conditional.
-#if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
-                // Always SSE2: x86_64 or Intel MacOS X
-                scrypt_1024_1_1_256_sp_sse2(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#else
-                // Detect SSE2: 32bit x86 Linux or Windows
-                scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#endif
-#else
-                // Generic scrypt
-                scrypt_1024_1_1_256_sp_generic(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#endif
+                // Hash two nonces at once with the interleaved scrypt core
+                memcpy(pheaders, BEGIN(pblock->nVersion), 80);
+                memcpy(pheaders + 80, pheaders, 80);
+                *(unsigned int*)(pheaders + 80 + 76) = pblock->nNonce + 1;
+                scrypt_1024_1_1_256_batch(pheaders, (char*)phashes, 2, &vScratchpad[0]);
 
-                if (thash <= hashTarget)
+                for (int i = 0; i < 2 && !fFound; i++)
                 {
-                    // Found a solution
-                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                    CheckWork(pblock.get(), *pwallet, reservekey);
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                    break;
+                    if (phashes[i] <= hashTarget)
+                    {
+                        // Found a solution
+                        pblock->nNonce += i;
+                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                        CheckWork(pblock.get(), *pwallet, reservekey);
+                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                        fFound = true;
+                    }
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if ((pblock->nNonce & 0xFF) == 0)
+                if (fFound)
+                    break;
+                pblock->nNonce += 2;
+                nHashesDone += 2;
+                if (nHashesDone >= 0x100)
                     break;
             }
 
@@ -4172,7 +4996,7 @@ void MineGenesisBlock(CBlock *pblock, bool fUpdateBlockTime /* = true*/)
     // Search
     //
     int64 nStart = GetTime();
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
     uint256 hashbuf[2];
     uint256& hash = *alignup<16>(hashbuf);
     loop
@@ -4265,13 +5089,20 @@ std::string CBlockIndex::ToString() const
             GetBlockHash().ToString().substr(0,20).c_str());
 }
 
-CBigNum CBlockIndex::GetBlockWork() const
+uint256 CBlockIndex::GetBlockWork() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
-    if (bnTarget <= 0)
+    bool fNegative;
+    bool fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnTarget == 0)
         return 0;
-    CBigNum work = (CBigNum(1)<<256) / (bnTarget+1);
+
+    // We need to compute 2**256 / (bnTarget+1), but we can't represent 2**256
+    // as it's too large for a uint256.  However, as 2**256 is at least as
+    // large as bnTarget+1, it is equal to ((2**256 - bnTarget - 1) /
+    // (bnTarget+1)) + 1, or ~bnTarget / (bnTarget+1) + 1.
+    uint256 work = (~bnTarget / (bnTarget + 1)) + 1;
 
     // Apply scrypt-to-SHA ratio
     // We assume that scrypt is 2^12 times harder to mine (for the same difficulty target)
@@ -11,6 +11,8 @@
 #include "walletdb.h"
 
 #include "scrypt.h"
+#include "sha256.h"
+#include "hashmap.h"
 
 #include <list>
 #ifndef Q_MOC_RUN
@@ -31,6 +33,7 @@ class CKeyItem;
 class CReserveKey;
 class CWalletDB;
 class CTestPool;
+class CScriptCheck;
 
 class CMessageHeader;
 class CAddress;
@@ -45,6 +48,9 @@ class CAuxPow;
 static const unsigned int MAX_BLOCK_SIZE = 1000000;
 static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 static const int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+// Block file number meaning "no file" (e.g. a block without game transactions)
+static const unsigned int BLOCKFILE_NONE = (unsigned int)-1;
 static const int64 COIN = 100000000;
 static const int64 CENT = 1000000;
 static const int64 MIN_TX_FEE = 500000;
@@ -72,13 +78,14 @@ extern int miningAlgo;
 extern CCriticalSection cs_main;
 extern CCriticalSection cs_AppendBlockFile;
 extern CCriticalSection cs_mapTransactions;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+typedef uint256HashMap<CBlockIndex*>::type BlockMap;
+extern BlockMap mapBlockIndex;
 extern uint256 hashGenesisBlock;
-extern CBigNum bnProofOfWorkLimit[NUM_ALGOS], bnInitialHashTarget[NUM_ALGOS];
+extern uint256 nProofOfWorkLimit[NUM_ALGOS], nInitialHashTarget[NUM_ALGOS];
 extern CBlockIndex* pindexGenesisBlock;
 extern int nBestHeight;
-extern CBigNum bnBestChainWork;
-extern CBigNum bnBestInvalidWork;
+extern uint256 nBestChainWork;
+extern uint256 nBestInvalidWork;
 extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
 extern unsigned int nTransactionsUpdated;
@@ -95,6 +102,10 @@ extern int64 nTransactionFee;
 extern int64 nMinimumInputValue;
 extern int fLimitProcessors;
 extern int nLimitProcessors;
+extern int nPoWCacheSize;
+extern bool fMmapBlockFiles;
+extern int nScriptCheckThreads;
+extern uint256 hashAssumeValid;
 extern int fMinimizeToTray;
 extern int fMinimizeOnClose;
 extern int fUseUPnP;
@@ -156,7 +167,15 @@ FILE* AppendBlockFile (DatabaseSet& dbset, unsigned int& nFileRet,
 void FlushBlockFile(FILE *f);
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
+void BenchmarkBlockIndexLookups();
+void BenchmarkSHA256();
+void BenchmarkBlockDeserialization();
+void BenchmarkScrypt();
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** Allocate a new (default-constructed) block index object from the arena */
+CBlockIndex* AllocateBlockIndex();
+/** Make sure the next nCount allocations are contiguous */
+void ReserveBlockIndexArena(unsigned int nCount);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
@@ -202,6 +221,71 @@ bool WriteSetting(const std::string& strKey, const T& value)
 }
 
 
+struct CBlockFile;
+
+/** Sequential reader for the block history files.  Descriptors come from a
+    small cache of open files, so that reading a block or transaction does not
+    cost an fopen/fseek each time.  Files that are no longer appended to are
+    mapped into memory (if enabled) and read straight from the mapping,
+    everything else goes through a read buffer.  The interface mimics that of
+    CAutoFile for deserialisation.  */
+class CBlockFileReader
+{
+private:
+    CBlockFile* pfile;
+    unsigned int nPos;
+    std::vector<char> vBuf;
+    unsigned int nBufStart;
+    unsigned int nBufEnd;
+    short state;
+    short exceptmask;
+
+    bool Fill();
+
+    // Not copyable, since it holds a reference to the cached file
+    CBlockFileReader(const CBlockFileReader&);
+    CBlockFileReader& operator=(const CBlockFileReader&);
+
+public:
+    int nType;
+    int nVersion;
+
+    CBlockFileReader(unsigned int nFile, unsigned int nPosIn, int nTypeIn=SER_DISK, int nVersionIn=VERSION);
+    ~CBlockFileReader();
+
+    bool operator!() const { return (pfile == NULL); }
+
+    void Seek(unsigned int nPosIn) { nPos = nPosIn; }
+    unsigned int Tell() const      { return nPos; }
+
+    void setstate(short bits, const char* psz)
+    {
+        state |= bits;
+        if (state & exceptmask)
+            throw std::ios_base::failure(psz);
+    }
+
+    bool fail() const            { return state & (std::ios::badbit | std::ios::failbit); }
+    bool good() const            { return state == 0; }
+    void clear(short n = 0)      { state = n; }
+
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CBlockFileReader& read(char* pch, int nSize);
+
+    template<typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        if (!pfile)
+            throw std::ios_base::failure("CBlockFileReader::operator>> : file not open");
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+
 class CDiskTxPos
 {
 public:
@@ -343,6 +427,19 @@ public:
     }
 };
 
+// Hasher for keying hashed containers by COutPoint
+class SaltedOutPointHasher
+{
+private:
+    SaltedUint256Hasher hasher;
+
+public:
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        return hasher(outpoint.hash) + outpoint.n;
+    }
+};
+
 
 
 
@@ -562,6 +659,16 @@ public:
     std::vector<CTxOut> vout;
     unsigned int nLockTime;
 
+    // memory only
+    // Transactions that have been read from a stream (network, disk or
+    // database) are not modified any more, so their hash is computed right
+    // when they are read and cached.  GetHash() never writes, so that it
+    // can be called from the script check threads.  Code that does modify
+    // such a transaction must call MakeMutable() first.
+    bool fFrozen;
+    bool fHashCached;
+    uint256 hashCached;
+
 
     CTransaction()
     {
@@ -575,6 +682,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            const_cast<CTransaction*>(this)->Freeze();
     )
 
     void SetNull()
@@ -583,6 +692,21 @@ public:
         vin.clear();
         vout.clear();
         nLockTime = 0;
+        MakeMutable();
+    }
+
+    void MakeMutable()
+    {
+        fFrozen = false;
+        fHashCached = false;
+    }
+
+    // For transactions that are constructed in memory and complete now
+    void Freeze()
+    {
+        hashCached = SerializeHash(*this);
+        fHashCached = true;
+        fFrozen = true;
     }
 
     bool IsNull() const
@@ -592,6 +716,8 @@ public:
 
     uint256 GetHash() const
     {
+        if (fHashCached)
+            return hashCached;
         return SerializeHash(*this);
     }
 
@@ -706,13 +832,11 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos)
     {
-        CAutoFile filein = OpenBlockFile(pos.nTxFile, 0, "rb");
+        CBlockFileReader filein(pos.nTxFile, pos.nTxPos);
         if (!filein)
-            return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
+            return error("CTransaction::ReadFromDisk() : opening block file failed");
 
         // Read transaction
-        if (fseek(filein, pos.nTxPos, SEEK_SET) != 0)
-            return error("CTransaction::ReadFromDisk() : fseek failed");
         filein >> *this;
         return true;
     }
@@ -760,7 +884,9 @@ public:
     
     bool ConnectInputs(DatabaseSet& dbset, CTestPool& testPool,
                        CDiskTxPos posThisTx, CBlockIndex* pindexBlock,
-                       int64& nFees, bool fBlock, bool fMiner, int64 nMinFee=0);
+                       int64& nFees, bool fBlock, bool fMiner, int64 nMinFee=0,
+                       std::vector<CScriptCheck>* pvChecks=NULL,
+                       bool fScriptChecks=true);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(DatabaseSet& dbset, bool fCheckInputs=true,
@@ -776,6 +902,39 @@ public:
 
 
 
+//
+// Deferred signature check for one input of a transaction.  ConnectInputs
+// does the UTXO bookkeeping serially and can hand these out, so that the
+// (independent) ECDSA verifications run on the script check threads.
+// The transaction must stay alive until the check has been run.
+//
+class CScriptCheck
+{
+private:
+    CTxOut txoFrom;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    int nHashType;
+
+public:
+    CScriptCheck() : ptxTo(NULL), nIn(0), nHashType(0) {}
+    CScriptCheck(const CTxOut& txoFromIn, const CTransaction& txToIn, unsigned int nInIn, int nHashTypeIn)
+        : txoFrom(txoFromIn), ptxTo(&txToIn), nIn(nInIn), nHashType(nHashTypeIn) {}
+
+    bool operator()() const;
+
+    void swap(CScriptCheck& check)
+    {
+        std::swap(txoFrom.nValue, check.txoFrom.nValue);
+        txoFrom.scriptPubKey.swap(check.txoFrom.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(nHashType, check.nHashType);
+    }
+};
+
+void StartScriptCheckThreads();
+
 //
 // A transaction with a merkle branch linking it to the block chain
 //
@@ -1034,6 +1193,15 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree, vGameMerkleTree;
+
+    // memory only
+    // Like for transactions, the hash of a block read from a stream is
+    // computed as soon as the header is read.  Blocks that are being built
+    // or mined are never frozen, since their header fields are changed all
+    // the time.
+    bool fFrozen;
+    bool fHashCached;
+    uint256 hashCached;
     
     // Game data
     uint256 hashGameMerkleRoot;            // disk, disk+header
@@ -1058,6 +1226,14 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+        if (fRead)
+        {
+            // nVersion is the stream version here, hash the member
+            CBlock* pthis = const_cast<CBlock*>(this);
+            pthis->hashCached = Hash(BEGIN(this->nVersion), END(this->nNonce));
+            pthis->fHashCached = true;
+            pthis->fFrozen = true;
+        }
 
         nSerSize += ReadWriteAuxPow(s, auxpow, nType, nVersion, ser_action);
 
@@ -1112,6 +1288,8 @@ public:
 
     uint256 GetHash() const
     {
+        if (fHashCached)
+            return hashCached;
         return Hash(BEGIN(nVersion), END(nNonce));
     }
 
@@ -1154,12 +1332,14 @@ public:
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            // The pairs of a level are adjacent in vMerkleTree, so all of
+            // them (except for a duplicated last one) are hashed as a batch
+            const int nPairs = nSize / 2;
+            vMerkleTree.resize(j + nSize + nPairs);
+            SHA256D64(vMerkleTree[j+nSize].begin(), vMerkleTree[j].begin(), nPairs);
+            if (nSize % 2)
+                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                           BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1])));
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -1272,10 +1452,20 @@ public:
     const uint256* phashBlock;
     CBlockIndex* pprev;
     CBlockIndex* pnext;
+
+    /* Pointer to some further-back ancestor, used by GetAncestor to
+       skip over long stretches of the chain.  */
+    CBlockIndex* pskip;
+
+    /* For each algo, the last strict ancestor that was mined with it
+       (or NULL if there is none).  This allows the retargeting code to
+       find the previous block of an algo without walking pprev.  */
+    CBlockIndex* pprevAlgo[NUM_ALGOS];
+
     unsigned int nFile;
     unsigned int nBlockPos;
     int nHeight;
-    CBigNum bnChainWork;
+    uint256 nChainWork;
 
     // block header
     int nVersion;
@@ -1289,10 +1479,13 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pskip = NULL;
+        for (int i = 0; i < NUM_ALGOS; ++i)
+            pprevAlgo[i] = NULL;
         nFile = 0;
         nBlockPos = 0;
         nHeight = 0;
-        bnChainWork = 0;
+        nChainWork = 0;
 
         nVersion       = 0;
         hashMerkleRoot = 0;
@@ -1307,10 +1500,13 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pskip = NULL;
+        for (int i = 0; i < NUM_ALGOS; ++i)
+            pprevAlgo[i] = NULL;
         nFile = nFileIn;
         nBlockPos = nBlockPosIn;
         nHeight = 0;
-        bnChainWork = 0;
+        nChainWork = 0;
 
         nVersion       = block.nVersion;
         hashMerkleRoot = block.hashMerkleRoot;
@@ -1347,7 +1543,16 @@ public:
         return (int64)nTime;
     }
 
-    CBigNum GetBlockWork() const;
+    uint256 GetBlockWork() const;
+
+    /* Fill in pskip and pprevAlgo.  pprev and nHeight must be set already,
+       and pprev must have its own links built.  */
+    void BuildSkip();
+
+    /* Return the ancestor of this block at the given height, or NULL if
+       the height is out of range.  */
+    CBlockIndex* GetAncestor(int height);
+    const CBlockIndex* GetAncestor(int height) const;
 
     bool IsInMainChain() const
     {
@@ -1519,7 +1724,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1565,7 +1770,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1584,7 +1789,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1600,7 +1805,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1823,7 +2028,8 @@ public:
 
 
 
-extern std::map<uint256, CTransaction> mapTransactions;
+typedef uint256HashMap<CTransaction>::type TxMap;
+extern TxMap mapTransactions;
 extern CHooks* hooks;
 
 void MineGenesisBlock(CBlock *pblock, bool fUpdateBlockTime = true);
@@ -1736,6 +1736,7 @@ bool StopNode()
     nTransactionsUpdated++;
     int64 nStart = GetTime();
     while (vnThreadsRunning[0] > 0 || vnThreadsRunning[2] > 0 || vnThreadsRunning[3] > 0 || vnThreadsRunning[4] > 0
+        || vnThreadsRunning[6] > 0
 #ifdef USE_UPNP
         || vnThreadsRunning[5] > 0
 #endif
@@ -1751,7 +1752,8 @@ bool StopNode()
     if (vnThreadsRunning[3] > 0) printf("ThreadBitcoinMiner still running\n");
     if (vnThreadsRunning[4] > 0) printf("ThreadRPCServer still running\n");
     if (fHaveUPnP && vnThreadsRunning[5] > 0) printf("ThreadMapPort still running\n");
-    while (vnThreadsRunning[2] > 0 || vnThreadsRunning[4] > 0)
+    if (vnThreadsRunning[6] > 0) printf("ThreadPruneGameDB still running\n");
+    while (vnThreadsRunning[2] > 0 || vnThreadsRunning[4] > 0 || vnThreadsRunning[6] > 0)
         MilliSleep(20);
     MilliSleep(50);
 
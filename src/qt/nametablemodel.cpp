@@ -282,7 +282,8 @@ NameTablePriv::listNames (std::map<vchType, NameTableEntry>& names,
   CRITICAL_BLOCK(cs_main)
   CRITICAL_BLOCK(wallet->cs_mapWallet)
     {
-      CTxDB txdb("r");
+      CReadDatabaseSet readDbset;
+      CTxDB& txdb = readDbset->tx ();
 
       BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, wallet->mapWallet)
         {
@@ -406,7 +407,7 @@ void NameTableModel::updateTransaction(const QString &hash, int status)
         LOCK(wallet->cs_wallet);
 
         // Find transaction in wallet
-        std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash256);
+        WalletTxMap::iterator mi = wallet->mapWallet.find(hash256);
         if (mi == wallet->mapWallet.end())
             return;    // Not our transaction
         tx = mi->second;
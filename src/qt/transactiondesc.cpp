@@ -91,7 +91,7 @@ QString TransactionDesc::toHTML(CWallet *wallet, CWalletTx &wtx)
                 }
                 else
                 {
-                    std::map<uint256, CWalletTx>::const_iterator mi = wallet->mapWallet.find(txin.prevout.hash);
+                    WalletTxMap::const_iterator mi = wallet->mapWallet.find(txin.prevout.hash);
                     if (mi != wallet->mapWallet.end())
                     {
                         const CWalletTx &prev = mi->second;
@@ -50,7 +50,7 @@ QList<TransactionRecord> TransactionRecord::decomposeTransaction(const CWallet *
             }
             else
             {
-                std::map<uint256, CWalletTx>::const_iterator mi = wallet->mapWallet.find(txin.prevout.hash);
+                WalletTxMap::const_iterator mi = wallet->mapWallet.find(txin.prevout.hash);
                 if (mi != wallet->mapWallet.end())
                 {
                     const CWalletTx &prev = mi->second;
@@ -261,7 +261,7 @@ void TransactionRecord::updateStatus(const CWalletTx &wtx)
 
     // Find the block the tx is in
     CBlockIndex* pindex = NULL;
-    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
     if (mi != mapBlockIndex.end())
         pindex = (*mi).second;
 
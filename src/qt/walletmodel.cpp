@@ -237,7 +237,8 @@ bool WalletModel::nameAvailable(const QString &name)
     std::string strName = name.toStdString();
     vchType vchName(strName.begin(), strName.end());
 
-    DatabaseSet dbset("r");
+    CReadDatabaseSet readDbset;
+    DatabaseSet& dbset = *readDbset;
     return NameAvailable (dbset, vchName);
 }
 
@@ -264,7 +265,8 @@ QString WalletModel::nameRegister(const QString &name, const std::string &data)
           return tr("there are pending operations on that name");
         }
 
-      CNameDB dbName("r");
+      CReadDatabaseSet readDbset;
+      CNameDB& dbName = readDbset->name ();
       CTransaction tx;
       if (GetTxOfName (dbName, vchName, tx) && !tx.IsGameTx ())
         {
@@ -325,7 +327,8 @@ QString WalletModel::nameUpdate(const QString &name, const std::string &data, co
 
         CTransaction tx;
         {
-          CNameDB dbName("r");
+          CReadDatabaseSet readDbset;
+          CNameDB& dbName = readDbset->name ();
           if (!GetTxOfName (dbName, vchName, tx))
             return tr("Could not find a coin with this name");
         }
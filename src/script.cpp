@@ -933,13 +933,99 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 }
 
 
+//
+// Cache of signatures that have already been verified successfully.
+// Transactions are usually checked when they enter the memory pool,
+// again when they are connected in a block and possibly a third time
+// by the miner.  Remembering (sighash, pubkey, signature) triples lets
+// all but the first of these skip the expensive ECDSA verification.
+// Only valid signatures are stored, so a hit can never make an invalid
+// script pass.  The entries are stored as a hash of the serialized triple
+// to keep the memory footprint small; the length prefixes make sure that
+// a different split of the same bytes into pubkey and signature does not
+// give the same entry.
+//
+int nSigCacheSize = 50000;
+
+class CSignatureCache
+{
+private:
+    set<uint256> setValid;
+    uint64 nHits;
+    uint64 nMisses;
+    CCriticalSection cs_sigcache;
+
+    static uint256 GetEntry(uint256 hash, const valtype& vchSig, const valtype& vchPubKey)
+    {
+        CDataStream ss(SER_GETHASH);
+        ss << hash << vchPubKey << vchSig;
+        return Hash(ss.begin(), ss.end());
+    }
+
+public:
+    CSignatureCache() : nHits(0), nMisses(0) {}
+
+    bool Get(const uint256& hash, const valtype& vchSig, const valtype& vchPubKey)
+    {
+        if (nSigCacheSize <= 0)
+            return false;
+        const uint256 entry = GetEntry(hash, vchSig, vchPubKey);
+        bool fFound = false;
+        CRITICAL_BLOCK(cs_sigcache)
+        {
+            fFound = (setValid.count(entry) > 0);
+            if (fFound)
+                ++nHits;
+            else
+                ++nMisses;
+        }
+        return fFound;
+    }
+
+    void Set(const uint256& hash, const valtype& vchSig, const valtype& vchPubKey)
+    {
+        if (nSigCacheSize <= 0)
+            return;
+        const uint256 entry = GetEntry(hash, vchSig, vchPubKey);
+        CRITICAL_BLOCK(cs_sigcache)
+        {
+            while (setValid.size() >= static_cast<unsigned int>(nSigCacheSize))
+            {
+                // Evict a random entry, so that an attacker can not
+                // predict which signatures stay in the cache
+                uint256 hashRand;
+                RAND_bytes((unsigned char*)&hashRand, sizeof(hashRand));
+                set<uint256>::iterator it = setValid.lower_bound(hashRand);
+                if (it == setValid.end())
+                    it = setValid.begin();
+                setValid.erase(it);
+            }
+            setValid.insert(entry);
+        }
+    }
+
+    void GetStats(unsigned int& nEntries, uint64& nHitsRet, uint64& nMissesRet)
+    {
+        CRITICAL_BLOCK(cs_sigcache)
+        {
+            nEntries = setValid.size();
+            nHitsRet = nHits;
+            nMissesRet = nMisses;
+        }
+    }
+};
+
+static CSignatureCache sigcache;
+
+void GetSigCacheStats(unsigned int& nEntries, uint64& nHits, uint64& nMisses)
+{
+    sigcache.GetStats(nEntries, nHits, nMisses);
+}
+
+
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
               const CTransaction& txTo, unsigned int nIn, int nHashType)
 {
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
-
     // Hash type is one byte tacked on to the end of the signature
     if (vchSig.empty())
         return false;
@@ -949,7 +1035,20 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    return key.Verify(SignatureHash(scriptCode, txTo, nIn, nHashType), vchSig);
+    // The pubkey is always validated, also for a cached signature
+    CKey key;
+    if (!key.SetPubKey(vchPubKey))
+        return false;
+
+    const uint256 hash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    if (sigcache.Get(hash, vchSig, vchPubKey))
+        return true;
+
+    if (!key.Verify(hash, vchSig))
+        return false;
+
+    sigcache.Set(hash, vchSig, vchPubKey);
+    return true;
 }
 
 
@@ -720,6 +720,9 @@ bool VerifySignature (const CTxOut& txoFrom, const CTransaction& txTo,
                       unsigned int nIn, int nHashType=0);
 bool ExtractDestination(const CScript& scriptPubKey, std::string& addressRet);
 
+extern int nSigCacheSize;
+void GetSigCacheStats(unsigned int& nEntries, uint64& nHits, uint64& nMisses);
+
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
 CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2);
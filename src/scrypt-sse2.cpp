@@ -92,6 +92,105 @@ static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
 	B[3] = _mm_add_epi32(B[3], X3);
 }
 
+/* Two independent xor_salsa8_sse2 computations, interleaved so that the
+   CPU can overlap their (otherwise serial) dependency chains.  */
+static inline void xor_salsa8_sse2_2way(__m128i B[4], const __m128i Bx[4],
+	__m128i C[4], const __m128i Cx[4])
+{
+	__m128i X0, X1, X2, X3;
+	__m128i Y0, Y1, Y2, Y3;
+	__m128i T, U;
+	int i;
+
+	X0 = B[0] = _mm_xor_si128(B[0], Bx[0]);
+	Y0 = C[0] = _mm_xor_si128(C[0], Cx[0]);
+	X1 = B[1] = _mm_xor_si128(B[1], Bx[1]);
+	Y1 = C[1] = _mm_xor_si128(C[1], Cx[1]);
+	X2 = B[2] = _mm_xor_si128(B[2], Bx[2]);
+	Y2 = C[2] = _mm_xor_si128(C[2], Cx[2]);
+	X3 = B[3] = _mm_xor_si128(B[3], Bx[3]);
+	Y3 = C[3] = _mm_xor_si128(C[3], Cx[3]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on "columns". */
+		T = _mm_add_epi32(X0, X3);
+		U = _mm_add_epi32(Y0, Y3);
+		X1 = _mm_xor_si128(X1, _mm_slli_epi32(T, 7));
+		Y1 = _mm_xor_si128(Y1, _mm_slli_epi32(U, 7));
+		X1 = _mm_xor_si128(X1, _mm_srli_epi32(T, 25));
+		Y1 = _mm_xor_si128(Y1, _mm_srli_epi32(U, 25));
+		T = _mm_add_epi32(X1, X0);
+		U = _mm_add_epi32(Y1, Y0);
+		X2 = _mm_xor_si128(X2, _mm_slli_epi32(T, 9));
+		Y2 = _mm_xor_si128(Y2, _mm_slli_epi32(U, 9));
+		X2 = _mm_xor_si128(X2, _mm_srli_epi32(T, 23));
+		Y2 = _mm_xor_si128(Y2, _mm_srli_epi32(U, 23));
+		T = _mm_add_epi32(X2, X1);
+		U = _mm_add_epi32(Y2, Y1);
+		X3 = _mm_xor_si128(X3, _mm_slli_epi32(T, 13));
+		Y3 = _mm_xor_si128(Y3, _mm_slli_epi32(U, 13));
+		X3 = _mm_xor_si128(X3, _mm_srli_epi32(T, 19));
+		Y3 = _mm_xor_si128(Y3, _mm_srli_epi32(U, 19));
+		T = _mm_add_epi32(X3, X2);
+		U = _mm_add_epi32(Y3, Y2);
+		X0 = _mm_xor_si128(X0, _mm_slli_epi32(T, 18));
+		Y0 = _mm_xor_si128(Y0, _mm_slli_epi32(U, 18));
+		X0 = _mm_xor_si128(X0, _mm_srli_epi32(T, 14));
+		Y0 = _mm_xor_si128(Y0, _mm_srli_epi32(U, 14));
+
+		/* Rearrange data. */
+		X1 = _mm_shuffle_epi32(X1, 0x93);
+		Y1 = _mm_shuffle_epi32(Y1, 0x93);
+		X2 = _mm_shuffle_epi32(X2, 0x4E);
+		Y2 = _mm_shuffle_epi32(Y2, 0x4E);
+		X3 = _mm_shuffle_epi32(X3, 0x39);
+		Y3 = _mm_shuffle_epi32(Y3, 0x39);
+
+		/* Operate on "rows". */
+		T = _mm_add_epi32(X0, X1);
+		U = _mm_add_epi32(Y0, Y1);
+		X3 = _mm_xor_si128(X3, _mm_slli_epi32(T, 7));
+		Y3 = _mm_xor_si128(Y3, _mm_slli_epi32(U, 7));
+		X3 = _mm_xor_si128(X3, _mm_srli_epi32(T, 25));
+		Y3 = _mm_xor_si128(Y3, _mm_srli_epi32(U, 25));
+		T = _mm_add_epi32(X3, X0);
+		U = _mm_add_epi32(Y3, Y0);
+		X2 = _mm_xor_si128(X2, _mm_slli_epi32(T, 9));
+		Y2 = _mm_xor_si128(Y2, _mm_slli_epi32(U, 9));
+		X2 = _mm_xor_si128(X2, _mm_srli_epi32(T, 23));
+		Y2 = _mm_xor_si128(Y2, _mm_srli_epi32(U, 23));
+		T = _mm_add_epi32(X2, X3);
+		U = _mm_add_epi32(Y2, Y3);
+		X1 = _mm_xor_si128(X1, _mm_slli_epi32(T, 13));
+		Y1 = _mm_xor_si128(Y1, _mm_slli_epi32(U, 13));
+		X1 = _mm_xor_si128(X1, _mm_srli_epi32(T, 19));
+		Y1 = _mm_xor_si128(Y1, _mm_srli_epi32(U, 19));
+		T = _mm_add_epi32(X1, X2);
+		U = _mm_add_epi32(Y1, Y2);
+		X0 = _mm_xor_si128(X0, _mm_slli_epi32(T, 18));
+		Y0 = _mm_xor_si128(Y0, _mm_slli_epi32(U, 18));
+		X0 = _mm_xor_si128(X0, _mm_srli_epi32(T, 14));
+		Y0 = _mm_xor_si128(Y0, _mm_srli_epi32(U, 14));
+
+		/* Rearrange data. */
+		X1 = _mm_shuffle_epi32(X1, 0x39);
+		Y1 = _mm_shuffle_epi32(Y1, 0x39);
+		X2 = _mm_shuffle_epi32(X2, 0x4E);
+		Y2 = _mm_shuffle_epi32(Y2, 0x4E);
+		X3 = _mm_shuffle_epi32(X3, 0x93);
+		Y3 = _mm_shuffle_epi32(Y3, 0x93);
+	}
+
+	B[0] = _mm_add_epi32(B[0], X0);
+	C[0] = _mm_add_epi32(C[0], Y0);
+	B[1] = _mm_add_epi32(B[1], X1);
+	C[1] = _mm_add_epi32(C[1], Y1);
+	B[2] = _mm_add_epi32(B[2], X2);
+	C[2] = _mm_add_epi32(C[2], Y2);
+	B[3] = _mm_add_epi32(B[3], X3);
+	C[3] = _mm_add_epi32(C[3], Y3);
+}
+
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad)
 {
 	uint8_t B[128];
@@ -134,3 +233,58 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+/* Hash two 80-byte inputs (input[0..159]) at once, interleaving the two
+   salsa chains.  scratchpad must be SCRYPT_2WAY_SCRATCHPAD_SIZE bytes.  */
+void scrypt_1024_1_1_256_sp_sse2_2way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[2][128];
+	union {
+		__m128i i128[8];
+		uint32_t u32[32];
+	} X[2];
+	__m128i *V, *W;
+	uint32_t i, j, jj, k, l;
+
+	V = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	W = V + 1024 * 8;
+
+	for (l = 0; l < 2; l++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B[l], 128);
+
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				X[l].u32[k * 16 + i] = le32dec(&B[l][(k * 16 + (i * 5 % 16)) * 4]);
+			}
+		}
+	}
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 8; k++) {
+			V[i * 8 + k] = X[0].i128[k];
+			W[i * 8 + k] = X[1].i128[k];
+		}
+		xor_salsa8_sse2_2way(&X[0].i128[0], &X[0].i128[4], &X[1].i128[0], &X[1].i128[4]);
+		xor_salsa8_sse2_2way(&X[0].i128[4], &X[0].i128[0], &X[1].i128[4], &X[1].i128[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		j = 8 * (X[0].u32[16] & 1023);
+		jj = 8 * (X[1].u32[16] & 1023);
+		for (k = 0; k < 8; k++) {
+			X[0].i128[k] = _mm_xor_si128(X[0].i128[k], V[j + k]);
+			X[1].i128[k] = _mm_xor_si128(X[1].i128[k], W[jj + k]);
+		}
+		xor_salsa8_sse2_2way(&X[0].i128[0], &X[0].i128[4], &X[1].i128[0], &X[1].i128[4]);
+		xor_salsa8_sse2_2way(&X[0].i128[4], &X[0].i128[0], &X[1].i128[4], &X[1].i128[0]);
+	}
+
+	for (l = 0; l < 2; l++) {
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < 16; i++) {
+				le32enc(&B[l][(k * 16 + (i * 5 % 16)) * 4], X[l].u32[k * 16 + i]);
+			}
+		}
+
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B[l], 128, 1, (uint8_t *)output + 32 * l, 32);
+	}
+}
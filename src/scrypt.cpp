@@ -279,17 +279,21 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 /* Always SSE2 */
+bool scrypt_have_sse2 = true;
+
 void scrypt_detect_sse2(unsigned int cpuid_edx)
 {
     printf("scrypt: using scrypt-sse2 as built.\n");
 }
 #else
 /* Detect SSE2 */
-void (*scrypt_1024_1_1_256_sp)(const char *input, char *output, char *scratchpad);
+void (*scrypt_1024_1_1_256_sp)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
+bool scrypt_have_sse2 = false;
 
 void scrypt_detect_sse2(unsigned int cpuid_edx)
 {
-    if (cpuid_edx & 1<<26)
+    scrypt_have_sse2 = (cpuid_edx & 1<<26) != 0;
+    if (scrypt_have_sse2)
     {
         scrypt_1024_1_1_256_sp = &scrypt_1024_1_1_256_sp_sse2;
         printf("scrypt: using scrypt-sse2 as detected.\n");
@@ -303,9 +307,8 @@ void scrypt_detect_sse2(unsigned int cpuid_edx)
 #endif
 #endif
 
-void scrypt_1024_1_1_256(const char *input, char *output)
+static inline void scrypt_1024_1_1_256_sp_auto(const char *input, char *output, char *scratchpad)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
 #if defined(USE_SSE2)
         // Detection would work, but in cases where we KNOW it always has SSE2,
         // it is faster to use directly than to use a function pointer or conditional.
@@ -321,3 +324,28 @@ void scrypt_1024_1_1_256(const char *input, char *output)
         scrypt_1024_1_1_256_sp_generic(input, output, scratchpad);
 #endif
 }
+
+void scrypt_1024_1_1_256(const char *input, char *output)
+{
+	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+	scrypt_1024_1_1_256_sp_auto(input, output, scratchpad);
+}
+
+void scrypt_1024_1_1_256_batch(const char *input, char *output, size_t n, char *scratchpad)
+{
+#if defined(USE_SSE2)
+	// Pairs of inputs go through the interleaved two-lane core
+	if (scrypt_have_sse2) {
+		for (; n >= 2; n -= 2) {
+			scrypt_1024_1_1_256_sp_sse2_2way(input, output, scratchpad);
+			input += 2 * 80;
+			output += 2 * 32;
+		}
+	}
+#endif
+	for (; n > 0; n--) {
+		scrypt_1024_1_1_256_sp_auto(input, output, scratchpad);
+		input += 80;
+		output += 32;
+	}
+}
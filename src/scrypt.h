@@ -3,13 +3,21 @@
 #include <stdlib.h>
 #include <stdint.h>
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
+static const int SCRYPT_2WAY_SCRATCHPAD_SIZE = 2 * 131072 + 63;
 
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/* Hash n consecutive 80-byte inputs into n consecutive 32-byte outputs,
+   using the two-lane core for pairs if possible.  scratchpad must be
+   SCRYPT_2WAY_SCRATCHPAD_SIZE bytes.  */
+void scrypt_1024_1_1_256_batch(const char *input, char *output, size_t n, char *scratchpad);
+
 #if defined(USE_SSE2)
 extern void scrypt_detect_sse2(unsigned int cpuid_edx);
+extern bool scrypt_have_sse2;
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_sse2_2way(const char *input, char *output, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp)(const char *input, char *output, char *scratchpad);
 #endif
 
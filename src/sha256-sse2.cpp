@@ -0,0 +1,217 @@
+/* 4-way SHA-256 using SSE2.  Each __m128i holds the same 32-bit word for
+   four independent messages, so that one pass of the compression function
+   processes four blocks at once.  This is used for batches of merkle tree
+   nodes and by the internal miner, which tries four nonces at a time.  */
+
+#include "sha256.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <emmintrin.h>
+
+static const uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t pInitState[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline __m128i Rotr(__m128i x, int n)
+{
+    return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n));
+}
+
+static inline __m128i Xor3(__m128i a, __m128i b, __m128i c)
+{
+    return _mm_xor_si128(_mm_xor_si128(a, b), c);
+}
+
+static inline __m128i Sigma0(__m128i x) { return Xor3(Rotr(x, 2), Rotr(x, 13), Rotr(x, 22)); }
+static inline __m128i Sigma1(__m128i x) { return Xor3(Rotr(x, 6), Rotr(x, 11), Rotr(x, 25)); }
+static inline __m128i sigma0(__m128i x) { return Xor3(Rotr(x, 7), Rotr(x, 18), _mm_srli_epi32(x, 3)); }
+static inline __m128i sigma1(__m128i x) { return Xor3(Rotr(x, 17), Rotr(x, 19), _mm_srli_epi32(x, 10)); }
+
+static inline __m128i Ch(__m128i x, __m128i y, __m128i z)
+{
+    return _mm_xor_si128(_mm_and_si128(x, y), _mm_andnot_si128(x, z));
+}
+
+static inline __m128i Maj(__m128i x, __m128i y, __m128i z)
+{
+    return _mm_or_si128(_mm_and_si128(x, y), _mm_and_si128(z, _mm_or_si128(x, y)));
+}
+
+static inline __m128i Add(__m128i a, __m128i b)
+{
+    return _mm_add_epi32(a, b);
+}
+
+// Compress one block per lane.  w[0..15] holds the message words and is
+// expanded in place.
+static void Transform4(__m128i s[8], __m128i w[64])
+{
+    for (int i = 16; i < 64; i++)
+        w[i] = Add(Add(sigma1(w[i-2]), w[i-7]), Add(sigma0(w[i-15]), w[i-16]));
+
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3];
+    __m128i e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++)
+    {
+        __m128i t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), Add(_mm_set1_epi32(K[i]), w[i])));
+        __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+static inline void InitState(__m128i s[8], const uint32_t* pinit)
+{
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm_set1_epi32(pinit[i]);
+}
+
+static inline void GetLanes(__m128i x, uint32_t lanes[4])
+{
+    _mm_storeu_si128((__m128i*)lanes, x);
+}
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+void SHA256D64_4way_sse2(unsigned char* out, const unsigned char* in)
+{
+    __m128i w[64];
+    __m128i s[8];
+
+    // First hash: the 64-byte message plus a padding block
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set_epi32(ReadBE32(in + 192 + 4*i), ReadBE32(in + 128 + 4*i),
+                             ReadBE32(in + 64 + 4*i), ReadBE32(in + 4*i));
+    InitState(s, pInitState);
+    Transform4(s, w);
+
+    w[0] = _mm_set1_epi32(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = _mm_setzero_si128();
+    w[15] = _mm_set1_epi32(512);
+    Transform4(s, w);
+
+    // Second hash: the 32-byte digest, padded to one block
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = _mm_set1_epi32(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = _mm_setzero_si128();
+    w[15] = _mm_set1_epi32(256);
+    InitState(s, pInitState);
+    Transform4(s, w);
+
+    for (int i = 0; i < 8; i++)
+    {
+        uint32_t lanes[4];
+        GetLanes(s[i], lanes);
+        for (int j = 0; j < 4; j++)
+            WriteBE32(out + 32*j + 4*i, lanes[j]);
+    }
+}
+
+// Same contract as ScanHash_CryptoPP in main.cpp:  pdata is the second
+// (big endian, byte-reversed by the caller) block of the header with the
+// nonce at offset 12, phash1 is preformatted with the padding for the
+// second hash.  The nonce in pdata is advanced and returned if the hash
+// has at least some zero bits; -1 is returned after 0x10000 nonces.
+unsigned int ScanHash_4WaySSE2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
+{
+    unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    const uint32_t* pdataWords = (const uint32_t*)pdata;
+    const uint32_t* pmidstateWords = (const uint32_t*)pmidstate;
+    uint32_t* phash1Words = (uint32_t*)phash1;
+    uint32_t* phashWords = (uint32_t*)phash;
+
+    __m128i w[64];
+    __m128i s[8];
+    __m128i s2[8];
+    for (;;)
+    {
+        const unsigned int n = nNonce;
+
+        for (int i = 0; i < 16; i++)
+            w[i] = _mm_set1_epi32(pdataWords[i]);
+        w[3] = _mm_set_epi32(n + 4, n + 3, n + 2, n + 1);
+        InitState(s, pmidstateWords);
+        Transform4(s, w);
+
+        for (int i = 0; i < 8; i++)
+            w[i] = s[i];
+        for (int i = 8; i < 16; i++)
+            w[i] = _mm_set1_epi32(phash1Words[i]);
+        InitState(s2, pInitState);
+        Transform4(s2, w);
+
+        // Return the first nonce whose hash has at least some zero bits,
+        // caller will check if it has enough to reach the target
+        uint32_t lanes7[4];
+        GetLanes(s2[7], lanes7);
+        for (int j = 0; j < 4; j++)
+        {
+            if ((lanes7[j] & 0xffff) != 0)
+                continue;
+
+            for (int i = 0; i < 8; i++)
+            {
+                uint32_t lanes[4];
+                GetLanes(s[i], lanes);
+                phash1Words[i] = lanes[j];
+                GetLanes(s2[i], lanes);
+                phashWords[i] = lanes[j];
+            }
+            nNonce = n + 1 + j;
+            return nNonce;
+        }
+
+        nNonce = n + 4;
+
+        // If nothing found after trying for a while, return -1
+        if ((nNonce & 0xffff) < 4)
+        {
+            nHashesDone = 0xffff+1;
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#include "sha256.h"
+#include "util.h"
+
+#include "cryptopp/cpu.h"
+
+#include <openssl/sha.h>
+
+#if defined(USE_SSE2)
+bool fSHA256UseSSE2 = false;
+#endif
+
+void SHA256D64_generic(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    unsigned char hash1[SHA256_DIGEST_LENGTH];
+    for (size_t i = 0; i < blocks; i++)
+    {
+        SHA256(in + 64 * i, 64, hash1);
+        SHA256(hash1, sizeof(hash1), out + 32 * i);
+    }
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+#if defined(USE_SSE2)
+    if (fSHA256UseSSE2)
+    {
+        while (blocks >= 4)
+        {
+            SHA256D64_4way_sse2(out, in);
+            out += 4 * 32;
+            in += 4 * 64;
+            blocks -= 4;
+        }
+    }
+#endif
+    SHA256D64_generic(out, in, blocks);
+}
+
+void sha256_detect()
+{
+#if defined(USE_SSE2)
+    fSHA256UseSSE2 = CryptoPP::HasSSE2();
+    if (fSHA256UseSSE2)
+    {
+        printf("sha256: using 4-way SSE2\n");
+        return;
+    }
+#endif
+    printf("sha256: using generic implementation\n");
+}
@@ -0,0 +1,26 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+
+/* Batched double-SHA256 of 64-byte blocks, which is what the inner nodes
+   of merkle trees need:  out[32*i, 32*i+32) = SHA256(SHA256(in[64*i, 64*i+64))).
+   Groups of four blocks are hashed in parallel if SSE2 is available.  */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+void SHA256D64_generic(unsigned char* out, const unsigned char* in, size_t blocks);
+
+/* Select the implementation to use, based on the CPU features.  This should
+   be called once at startup; before that, the generic code is used.  */
+void sha256_detect();
+
+#if defined(USE_SSE2)
+extern bool fSHA256UseSSE2;
+
+/* Hash exactly four blocks.  */
+void SHA256D64_4way_sse2(unsigned char* out, const unsigned char* in);
+
+/* Miner inner loop trying four nonces at once (see ScanHash_CryptoPP).  */
+unsigned int ScanHash_4WaySSE2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+#endif
+
+#endif
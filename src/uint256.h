@@ -7,6 +7,7 @@
 #include "serialize.h"
 
 #include <limits.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -182,6 +183,93 @@ public:
     }
 
 
+    base_uint& operator*=(unsigned int b32)
+    {
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    base_uint& operator*=(const base_uint& b)
+    {
+        base_uint a;
+        for (int i = 0; i < WIDTH; i++)
+            a.pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64 carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64 n = carry + a.pn[i + j] + (uint64)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
+    base_uint& operator/=(const base_uint& b)
+    {
+        base_uint div = b;     // make a copy, so we can shift.
+        base_uint num = *this; // make a copy, so we can subtract.
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int num_bits = num.bits();
+        int div_bits = div.bits();
+        if (div_bits == 0)
+            throw std::runtime_error("base_uint: division by zero");
+        if (div_bits > num_bits) // the result is certainly 0.
+            return *this;
+        int shift = num_bits - div_bits;
+        div <<= shift; // shift so that div and num align.
+        while (shift >= 0)
+        {
+            if (num >= div)
+            {
+                num -= div;
+                pn[shift / 32] |= (1U << (shift & 31)); // set a bit of the result.
+            }
+            div >>= 1; // shift back.
+            shift--;
+        }
+        // num now contains the remainder of the division.
+        return *this;
+    }
+
+    // Returns the position of the highest bit set plus one, or zero if the
+    // value is zero.
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH-1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int bits = 31; bits > 0; bits--)
+                    if (pn[pos] & (1U << bits))
+                        return 32 * pos + bits + 1;
+                return 32 * pos + 1;
+            }
+        }
+        return 0;
+    }
+
+    uint64 GetLow64() const
+    {
+        return pn[0] | (uint64)pn[1] << 32;
+    }
+
+    uint64 Get64(int n=0) const
+    {
+        return pn[2*n] | (uint64)pn[2*n+1] << 32;
+    }
+
+
     base_uint& operator++()
     {
         // prefix operator
@@ -576,6 +664,61 @@ public:
         else
             *this = 0;
     }
+
+    // The "compact" format is a representation of a whole number N using an
+    // unsigned 32-bit number similar to a floating point format.  It is the
+    // same encoding as used by CBigNum::SetCompact / GetCompact:  The most
+    // significant 8 bits are the unsigned exponent of base 256, the next bit
+    // is the sign and the lower 23 bits are the mantissa.
+    //
+    // Since uint256 is unsigned, negative or overflowing values can't be
+    // represented.  They are reported through pfNegative and pfOverflow.
+    uint256& SetCompact(unsigned int nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        int nSize = nCompact >> 24;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = (nWord != 0 && (nCompact & 0x00800000) != 0);
+        if (pfOverflow)
+            *pfOverflow = (nWord != 0 && ((nSize > 34)
+                                          || (nWord > 0xff && nSize > 33)
+                                          || (nWord > 0xffff && nSize > 32)));
+        return *this;
+    }
+
+    unsigned int GetCompact(bool fNegative = false) const
+    {
+        int nSize = (bits() + 7) / 8;
+        unsigned int nCompact = 0;
+        if (nSize <= 3)
+            nCompact = GetLow64() << 8 * (3 - nSize);
+        else
+        {
+            uint256 bn(*this);
+            bn >>= 8 * (nSize - 3);
+            nCompact = bn.GetLow64();
+        }
+        // The 0x00800000 bit denotes the sign.  Thus, if it is already set,
+        // divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        nCompact |= (fNegative && (nCompact & 0x007fffff) ? 0x00800000 : 0);
+        return nCompact;
+    }
 };
 
 inline bool operator==(const uint256& a, uint64 b)                           { return (base_uint256)a == b; }
@@ -627,6 +770,10 @@ inline const uint256 operator|(const uint256& a, const uint256& b)      { return
 inline const uint256 operator+(const uint256& a, const uint256& b)      { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const uint256& b)      { return (base_uint256)a -  (base_uint256)b; }
 
+inline const uint256 operator*(const uint256& a, unsigned int b)        { return uint256(a) *= b; }
+inline const uint256 operator*(const uint256& a, const uint256& b)      { return uint256(a) *= b; }
+inline const uint256 operator/(const uint256& a, const uint256& b)      { return uint256(a) /= b; }
+
 
 
 
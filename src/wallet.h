@@ -7,6 +7,7 @@
 #include "bignum.h"
 #include "key.h"
 #include "script.h"
+#include "hashmap.h"
 
 #ifdef GUI
 #include "qt/ui_interface.h"  // For ChangeType
@@ -17,6 +18,8 @@ class CReserveKey;
 class CWalletDB;
 class COutput;
 
+typedef uint256HashMap<CWalletTx>::type WalletTxMap;
+
 class CWallet : public CKeyStore
 {
 private:
@@ -72,7 +75,7 @@ public:
         pwalletdbEncryption = NULL;
     }
 
-    std::map<uint256, CWalletTx> mapWallet;
+    WalletTxMap mapWallet;
     //std::vector<uint256> vWalletUpdated;
 
     std::map<uint256, int> mapRequestCount;
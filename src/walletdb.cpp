@@ -135,8 +135,8 @@ bool CWalletDB::LoadWallet(CWallet* pwallet)
         loop
         {
             // Read next record
-            CDataStream ssKey;
-            CDataStream ssValue;
+            CSecureDataStream ssKey;
+            CSecureDataStream ssValue;
             int ret = ReadAtCursor(pcursor, ssKey, ssValue);
             if (ret == DB_NOTFOUND)
                 break;